@@ -0,0 +1,130 @@
+/* counts the allocations editorRefreshScreen makes a frame, and times the
+   frames, for moving the cursor, scrolling and typing once the first frame
+   has grown the draw buffers.  Builds the editor in with its main renamed
+   and malloc, calloc, realloc and strdup counted so it's the same code that
+   draws the screen - make bench.  Exits 1 if moving the cursor or scrolling
+   allocates more than once in a while. */
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+long benchAllocs;
+
+void *benchMalloc(size_t n) {
+  benchAllocs++;
+  return malloc(n);
+}
+
+void *benchCalloc(size_t n, size_t size) {
+  benchAllocs++;
+  return calloc(n, size);
+}
+
+void *benchRealloc(void *p, size_t n) {
+  benchAllocs++;
+  return realloc(p, n);
+}
+
+char *benchStrdup(const char *s) {
+  benchAllocs++;
+  return strdup(s);
+}
+
+// the editor defines these itself - stdlib.h has already been set up by them
+#undef _DEFAULT_SOURCE
+#undef _BSD_SOURCE
+#undef _GNU_SOURCE
+#define malloc(n) benchMalloc(n)
+#define calloc(n, size) benchCalloc(n, size)
+#define realloc(p, n) benchRealloc(p, n)
+#define strdup(s) benchStrdup(s)
+#define main kilo_main
+#include "kilo_lw_scroll.c"
+#undef main
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+
+#define BENCH_FRAMES 2000
+
+double benchNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// makes text the file being edited - through a temporary file so it's read the way a real one is
+void benchOpen(const char *text, int len) {
+  char path[] = "/tmp/frame_benchXXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1 || write(fd, text, len) != len) die("frame_bench");
+  unlink(path);
+  memset(&E, 0, sizeof(E));
+  E.screenrows = 22;
+  E.screencols = E.linecols = 78;
+  E.piecetable = 1;
+  E.undomax = UNDO_MEM_DEFAULT;
+  E.changedrow = INT_MAX;
+  E.highlight[0] = E.highlight[1] = -1;
+  E.indent = 4;
+  editorOpenPieces(fd);
+  close(fd);
+  editorIndexAll();
+  editorUndoClear();
+}
+
+/* draws frames frames, doing key before each - alternating with back if
+   there is one, or typing if key is 0 - and returns the allocations a frame
+   made.  The screen goes to stdout, which main points at /dev/null, and the
+   results to out */
+double benchFrames(FILE *out, const char *what, int frames, int key, int back) {
+  long allocs = benchAllocs;
+  double t = benchNow();
+  for (int i = 0; i < frames; i++) {
+    if (key) editorMoveCursor(back && i % 2 ? back : key);
+    else editorInsertChar('a' + i % 26);
+    editorRefreshScreen();
+  }
+  t = benchNow() - t;
+  double perframe = (double)(benchAllocs - allocs) / frames;
+  fprintf(out, "%-8s %5d frames  %6ld allocs  %8.3f allocs/frame  %8.1f us/frame\n", what, frames,
+          benchAllocs - allocs, perframe, t / frames * 1e6);
+  return perframe;
+}
+
+int main(void) {
+  // rows of differing lengths, some long enough to wrap
+  char *text = malloc(5000 * 200);
+  int len = 0;
+  srand(1);
+  for (int i = 0; i < 5000; i++) {
+    int n = rand() % 160;
+    for (int j = 0; j < n; j++) text[len++] = (j % 7 == 6) ? ' ' : 'a' + (i + j) % 26;
+    text[len++] = '\n';
+  }
+  benchOpen(text, len);
+
+  FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+  int null = open("/dev/null", O_WRONLY);
+  if (out == NULL || null == -1) die("frame_bench");
+  dup2(null, STDOUT_FILENO);
+
+  benchFrames(out, "first", 1, ARROW_RIGHT, 0);
+  double moves = benchFrames(out, "cursor", BENCH_FRAMES, ARROW_RIGHT, ARROW_LEFT);
+  // down runs off the bottom of the screen and then scrolls every frame
+  double scroll = benchFrames(out, "scroll", BENCH_FRAMES, ARROW_DOWN, 0);
+  // typing counts what the edit allocates as well as the frame
+  E.mode = 1;
+  benchFrames(out, "type", BENCH_FRAMES, 0, 0);
+
+  // a buffer can still grow the first time a longer line is drawn, but that's not every frame
+  if (moves > 0.01 || scroll > 0.01) {
+    fprintf(out, "drawing allocated on frames that only moved the cursor or scrolled\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* times splitting a file into lines the way -c reads it (getline) against
+   scanNewlines with each of the scanners the cpu has, and against the whole
+   piece table open, on 100MB and 1GB files of ordinary lines and on a file
+   of many short ones.  Builds the editor in with its main renamed so it's
+   the same code opening a file runs - make bench.  Exits 1 if they don't
+   all find the same number of lines. */
+
+#define main kilo_main
+#include "kilo_lw_scroll.c"
+#undef main
+
+#define BENCH_MB (1024*1024)
+
+double benchNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// E as main sets it up, with nothing open
+void benchReset(int piecetable) {
+  memset(&E, 0, sizeof(E));
+  E.screenrows = 22;
+  E.screencols = E.linecols = 78;
+  E.piecetable = piecetable;
+  E.undomax = UNDO_MEM_DEFAULT;
+  E.changedrow = INT_MAX;
+  E.highlight[0] = E.highlight[1] = -1;
+}
+
+/* writes a temporary file of size bytes of lines from 0 to 2*avg - 2
+   characters long, so avg bytes a line counting the '\n' */
+void benchFile(char *path, size_t size, int avg) {
+  int fd = mkstemp(path);
+  if (fd == -1) die("index_bench");
+  char *buf = malloc(BENCH_MB + 2 * avg);
+  srand(1);
+  size_t left = size;
+  while (left > 0) {
+    int n = 0;
+    while (n < BENCH_MB) {
+      int len = rand() % (2 * avg - 1);
+      memset(&buf[n], 'a' + len % 26, len);
+      buf[n + len] = '\n';
+      n += len + 1;
+    }
+    if ((size_t)n > left) n = left;
+    if (write(fd, buf, n) != n) die("index_bench");
+    left -= n;
+  }
+  close(fd);
+  free(buf);
+}
+
+// lines getline finds in path
+int benchGetline(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) die("fopen");
+  char *line = NULL;
+  size_t linecap = 0;
+  int n = 0;
+  while (getline(&line, &linecap, fp) != -1) n++;
+  free(line);
+  fclose(fp);
+  return n;
+}
+
+void benchCountLine(void *arg, char *p, char *eol) {
+  (void)p;
+  (void)eol;
+  (*(int *)arg)++;
+}
+
+// lines scan finds in the file mapped at p
+int benchScan(int (*scan)(const char *, int, int *), char *p, size_t len) {
+  static int nls[SCAN_BLOCK];
+  int n = 0;
+  scanNewlines = scan;
+  scanLines(p, p + len, p + len, nls, benchCountLine, &n);
+  return n;
+}
+
+double benchReport(const char *what, const char *how, size_t size, double t, int lines) {
+  printf("%-12s %-14s %5zu MB  %8.1f ms  %6.0f MB/s  %d lines\n", what, how, size / BENCH_MB, t * 1000,
+         size / BENCH_MB / t, lines);
+  return t;
+}
+
+// times each way of finding the lines of a file - 0 if they didn't agree
+int benchIndex(const char *what, size_t size, int avg, int withc) {
+  char path[] = "/tmp/index_benchXXXXXX";
+  benchFile(path, size, avg);
+  int ok = 1;
+
+  double t = benchNow();
+  int lines = benchGetline(path);
+  benchReport(what, "getline", size, benchNow() - t, lines);
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) die("open");
+  char *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) die("mmap");
+  struct { const char *name; int (*scan)(const char *, int, int *); } scanners[] = {
+    {"scan scalar", scanNewlinesScalar},
+#ifdef KILO_SIMD_X86
+    {"scan SSE2", __builtin_cpu_supports("sse2") ? scanNewlinesSSE2 : NULL},
+    {"scan AVX2", __builtin_cpu_supports("avx2") ? scanNewlinesAVX2 : NULL},
+#endif
+  };
+  for (size_t i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+    if (scanners[i].scan == NULL) continue;
+    t = benchNow();
+    int n = benchScan(scanners[i].scan, p, size);
+    benchReport(what, scanners[i].name, size, benchNow() - t, n);
+    if (n != lines) ok = 0;
+  }
+  munmap(p, size);
+
+  // the open the editor does, scanner picked the way it picks it
+  scanNewlines = NULL;
+  benchReset(1);
+  t = benchNow();
+  editorOpen(path);
+  editorIndexAll();
+  benchReport(what, "open", size, benchNow() - t, E.filerows);
+  if (E.filerows != lines) ok = 0;
+
+  // -c keeps every row in memory of its own so it's left out for the biggest file
+  if (withc) {
+    benchReset(0);
+    t = benchNow();
+    editorOpen(path);
+    benchReport(what, "open -c", size, benchNow() - t, E.filerows);
+    if (E.filerows != lines) ok = 0;
+  }
+
+  unlink(path);
+  if (!ok) printf("%s: not every way found %d lines\n", what, lines);
+  return ok;
+}
+
+int main(void) {
+  __builtin_cpu_init();
+  int ok = benchIndex("80 col", 100 * (size_t)BENCH_MB, 80, 1);
+  ok &= benchIndex("short lines", 32 * (size_t)BENCH_MB, 4, 1);
+  ok &= benchIndex("80 col", 1024 * (size_t)BENCH_MB, 80, 0);
+  return ok ? 0 : 1;
+}
@@ -7,16 +7,27 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KILO_SIMD_X86
+#include <immintrin.h>
+#endif
+
 /*** defines ***/
 
 #define KILO_VERSION "0.0.1"
@@ -34,7 +45,9 @@ enum editorKey {
   HOME_KEY,
   END_KEY,
   PAGE_UP,
-  PAGE_DOWN
+  PAGE_DOWN,
+  PASTE_START, //<esc>[200~ - bracketed paste, see editorReadPaste
+  PASTE_END //<esc>[201~
 };
 
 enum Command {
@@ -49,6 +62,8 @@ enum Command {
   C_unindent,
   C_c$,
   C_gg,
+  C_gminus,
+  C_gplus,
   C_yy
 };
 
@@ -56,9 +71,67 @@ enum Command {
 
 typedef struct erow {
   int size; //the number of characters in the line
-  char *chars; //points at the character array of a row - mem assigned by malloc
+  char *chars; //gap buffer holding the characters of a row - mem assigned by malloc
+  int gap; //where the gap in chars starts
+  int gaplen; //size of the gap - chars has size + gaplen + 1 bytes
+  const char *piece; //when chars is NULL the row is the read-only text here - see piece table
+  struct rowchunk *chunk; //the chunk the row is stored in - kept up to date by the row store
 } erow;
 
+/* blocks of the append-only add buffer - text is never moved or freed once
+   it is in a block so rows can point straight at it */
+#define ADDBLOCK_SIZE (1024*1024)
+
+typedef struct addblock {
+  struct addblock *next;
+  size_t len;
+  size_t cap;
+  char text[];
+} addblock;
+
+/* rows are kept in fixed size chunks instead of one flat array so inserting
+   or deleting a row only has to move the erows in its own chunk */
+#define ROWS_PER_CHUNK 512
+
+typedef struct rowchunk {
+  int numrows; //rows in use in this chunk
+  int idx; //position of the chunk in E.chunks
+  int lines; //screen lines the rows in this chunk take up when wrapped
+  long long bytes; //sum of the sizes of its rows - for finding a row's offset in the file
+  erow rows[ROWS_PER_CHUNK];
+} rowchunk;
+
+/* a change to the text as recorded in the undo journal - text is what was
+   inserted or deleted (the whole row for row changes).  It's a malloc'd
+   buffer the record owns unless shared is set, in which case it's the row's
+   own piece of the original file or add buffer, which are never changed or
+   freed, so deleting or inserting whole rows doesn't copy their text */
+enum undoType {
+  U_ROW_INS,
+  U_ROW_DEL,
+  U_SPAN_INS,
+  U_SPAN_DEL
+};
+
+typedef struct undorec {
+  int type;
+  int fr; //file row
+  int at; //file column - spans only
+  int len;
+  char *text;
+  int shared;
+} undorec;
+
+/* the groups of records (one per command) form a tree - making a change
+   after an undo starts a new branch instead of throwing away what was undone */
+typedef struct undogroup {
+  int start, len; //its records in the journal
+  int parent; //the group it was made after - -1 for the root, which is the file as read and has no records
+  int lastchild; //where CTRL-R goes - the newest child or the one last undone, -1 if none
+  int seq; //groups are numbered in the order they were made - g- and g+ go by that
+  long long time; //when it was made - for :earlier and :later
+} undogroup;
+
 struct editorConfig {
   int cx, cy; //cursor x and y position
   int rx; //index into the render field - only nec b/o tabs
@@ -67,17 +140,42 @@ struct editorConfig {
   int screenrows; //number of rows in the display
   int screencols;  //number of columns in the display
   int filerows; // the number of rows(lines) of text delineated by /n if written out to a file
-  erow *row; //(e)ditorrow stores a pointer to a contiguous collection of erow structures 
-  int prev_filerows; // the number of rows of text so last text row is always row numrows
-  erow *prev_row; //for undo purposes
+  rowchunk **chunks; //the rows of the file - only accessed through editorRow()
+  int numchunks;
+  int chunkcap; //room in chunks and the trees below
+  int *chunkrows; //fenwick tree of the number of rows in each chunk
+  int *chunklines; //fenwick tree of the number of screen lines in each chunk
+  int linecols; //the screen width the line counts were made with
+  int linegen; //bumped whenever rows are added/removed or wrap to a different number of lines
+  int piecetable; //rows point into orig/the add buffer until edited; -c turns this off
+  char *orig; //the file as it was read in - never modified
+  size_t origlen;
+  int origmapped; //orig is mmap'd rather than read in
+  size_t indexed; //how much of orig has been split into rows so far - see editorIndexMore
+  addblock *addbuf; //most recent block of the add buffer
+  undorec *undo; //the undo journal - see editorJournal
+  int undolen;
+  int undocap;
+  undogroup *undogroups; //the undo tree in the order the groups were made - undogroups[0] is the root
+  int numgroups;
+  int groupcap;
+  int curgroup; //the group the file is at - it and its ancestors are done, everything else isn't
+  int newgroup; //set by editorCreateSnapshot so the next change starts a group
+  int lastseq;
+  size_t undomem; //what the journal takes up - records and the text they own
+  size_t undomax; //when undomem gets past this editorUndoTrim throws old history away
+  int replaying; //changes made while undoing/redoing aren't journaled
   int dirty; //file changes since last save
+  int changedrow; //rows before this are as they were when the file was read or last saved - INT_MAX if none changed
+  struct stat disk; //the file as it was read or last saved - st_ino is 0 when that isn't known
+  int disklines; //that file is the rows each followed by one '\n' - -1 until editorSaveTail checks
   char *filename;
   char statusmsg[120]; //status msg is a character array max 80 char
   //time_t statusmsg_time;
   struct termios orig_termios;
   int highlight[2];
   int mode;
-  char command[20]; //needs to accomodate file name ?malloc heap array
+  char command[256]; //needs to accomodate file name or a :s command
   int repeat;
   int indent;
   int smartindent;
@@ -86,7 +184,8 @@ struct editorConfig {
 
 struct editorConfig E;
 
-char search_string[30] = {'\0'}; //used for '*' and 'n' searches
+char search_string[256] = {'\0'}; //used for '*', '/' and 'n' searches
+int search_regex = 0; //search_string is a pattern from '/' rather than a word from '*'
 
 // buffers below for yanking
 char *line_buffer[20] = {NULL}; //yanking lines
@@ -104,6 +203,8 @@ static t_symstruct lookuptable[] = {
   {">>", C_indent},
   {"<<", C_unindent},
   {"gg", C_gg},
+  {"g-", C_gminus},
+  {"g+", C_gplus},
   {"yy", C_yy},
   {"d$", C_d$}
 };
@@ -113,6 +214,8 @@ static t_symstruct lookuptable[] = {
 /*** prototypes ***/
 
 void editorSetMessage(const char *fmt, ...);
+void editorUndoTrim(void);
+void editorMatchesChanged(int type, int fr);
 void editorRefreshScreen(void);
 void getcharundercursor(void);
 void editorDecorateWord(int c);
@@ -138,15 +241,29 @@ void editorMoveNextWord(void);
 void editorMarkupLink(void);
 void getWordUnderCursor(void);
 void editorFindNextWord(void);
+void editorFindPrevWord(void);
+void editorSubstitute(char *cmd);
+void editorGotoMatch(int y, int fc);
+void editorSearchIdle(void);
 void editorChangeCase(void);
 void editorRestoreSnapshot(void); 
 void editorCreateSnapshot(void); 
+void editorRedo(void);
+void editorUndoTime(int count, int bytime, int later);
+erow *editorRow(int fr);
 int editorGetFileCol(void);
 int editorGetFileRowByLine (int y);
 int editorGetFileRow(void);
 int editorGetLineCharCount (void); 
 int editorGetScreenLineFromFileRow(int fr);
 int *editorGetScreenPosFromFilePos(int fr, int fc);
+void editorIndexIdle(void);
+void editorSwapLog(int type, int fr, int at, const char *text, int len);
+void editorSwapSaveStart(void);
+void editorSwapSaved(int ok);
+void editorSwapKeep(void);
+int editorSavePoll(void);
+void editorSaveWait(void);
 
 int keyfromstring(char *key)
 {
@@ -168,10 +285,12 @@ void die(const char *s) {
   write(STDOUT_FILENO, "\x1b[H", 3);
 
   perror(s);
+  editorSwapKeep();
   exit(1);
 }
 
 void disableRawMode(void) {
+  write(STDOUT_FILENO, "\x1b[?2004l", 8); //bracketed paste off
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
     die("tcsetattr");
 }
@@ -189,12 +308,43 @@ void enableRawMode(void) {
   raw.c_cc[VTIME] = 1; // timeout for read will return 0 if no bytes read
 
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+
+  // bracketed paste - the terminal wraps pasted text in <esc>[200~ ... <esc>[201~
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+/* input is read in chunks of whatever is available and handed out a byte at
+   a time so typing ahead or pasting costs one read() rather than one per
+   byte, and main can handle every key that is already waiting before it
+   redraws - see editorKeysPending */
+char inbuf[4096];
+int inlen = 0;
+int inpos = 0;
+
+// returns 0 if nothing arrived before the read timed out (0.1 sec)
+int editorReadByte(char *c) {
+  if (inpos == inlen) {
+    int nread = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+    if (nread == -1 && errno != EAGAIN) die("read");
+    if (nread <= 0) return 0;
+    inlen = nread;
+    inpos = 0;
+  }
+  *c = inbuf[inpos++];
+  return 1;
+}
+
+int editorKeysPending(void) {
+  return inpos < inlen;
 }
 
 int editorReadKey(void) {
-  int nread;
   char c;
 
+  editorSavePoll();
+  if (!editorKeysPending()) editorIndexIdle();
+  if (!editorKeysPending()) editorSearchIdle();
+
   /* read is from <unistd.h> - not sure why read is used and not getchar <stdio.h>
    prototype is: ssize_t read(int fd, void *buf, size_t count); 
    On success, the number of bytes read is returned (zero indicates end of file)
@@ -203,9 +353,9 @@ int editorReadKey(void) {
 
    /*Note that ctrl-key maps to ctrl-A=1, ctrl-b=2 etc.*/
 
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-    if (nread == -1 && errno != EAGAIN) die("read");
-  }
+  // the read times out every 0.1s, which is when a background save gets looked at
+  while (!editorReadByte(&c))
+    if (editorSavePoll()) editorRefreshScreen();
 
   /* if the character read was an escape, need to figure out if it was
      a recognized escape sequence or an isolated escape to switch from
@@ -216,12 +366,20 @@ int editorReadKey(void) {
     char seq[3];
     //editorSetMessage("You pressed %d", c); //slz
     // the reads time out after 0.1 seconds
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+    if (!editorReadByte(&seq[0])) return '\x1b';
+    if (!editorReadByte(&seq[1])) return '\x1b';
 
     // Assumption is that seq[0] == '[' 
     if (seq[1] >= '0' && seq[1] <= '9') {
-      if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b'; //need 4 bytes
+      if (!editorReadByte(&seq[2])) return '\x1b'; //need 4 bytes
+      if (seq[1] == '2' && seq[2] == '0') {
+        // <esc>[200~ and <esc>[201~ bracket a paste
+        char d, tilde;
+        if (!editorReadByte(&d) || !editorReadByte(&tilde) || tilde != '~') return '\x1b';
+        if (d == '0') return PASTE_START;
+        if (d == '1') return PASTE_END;
+        return '\x1b';
+      }
       if (seq[2] == '~') {
         //editorSetMessage("You pressed %c%c%c", seq[0], seq[1], seq[2]); //slz
         switch (seq[1]) {
@@ -254,6 +412,55 @@ int editorReadKey(void) {
   }
 }
 
+#define PASTE_IDLE 10 //reads in a row that time out (0.1 sec each) before a paste is given up on
+#define PASTE_MAX (64*1024*1024)
+
+/* reads everything up to the <esc>[201~ that ends a bracketed paste and
+   returns it malloc'd with newlines as '\n' - the terminal sends them as '\r'.
+   If the end never comes (a terminal that dropped it, a paste cut short) it
+   stops after a second with nothing arriving or once PASTE_MAX has been read,
+   and what's there is pasted - anything after that is read as keys */
+char *editorReadPaste(int *len) {
+  int cap = 4096;
+  int n = 0;
+  char *buf = malloc(cap);
+  char c;
+  int idle = 0;
+
+  for (;;) {
+    if (!editorReadByte(&c)) {
+      if (++idle < PASTE_IDLE) continue;
+      editorSetMessage("Paste didn't end - pasted what arrived");
+      break;
+    }
+    idle = 0;
+    if (n == PASTE_MAX) {
+      inpos--; //c is left to be read as a key
+      editorSetMessage("Paste is over %d MB - pasted the first %d MB", PASTE_MAX / (1024*1024), PASTE_MAX / (1024*1024));
+      break;
+    }
+    if (n == cap) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+    buf[n++] = c;
+    if (n >= 6 && memcmp(&buf[n - 6], "\x1b[201~", 6) == 0) {
+      n -= 6;
+      break;
+    }
+  }
+
+  int j = 0;
+  for (int i = 0; i < n; i++) {
+    if (buf[i] == '\r') {
+      buf[j++] = '\n';
+      if (i + 1 < n && buf[i + 1] == '\n') i++;
+    } else buf[j++] = buf[i];
+  }
+  *len = j;
+  return buf;
+}
+
 int getWindowSize(int *rows, int *cols) {
 
 //TIOCGWINSZ = fill in the winsize structure
@@ -278,35 +485,937 @@ int getWindowSize(int *rows, int *cols) {
   }
 }
 
+/*** row store ***/
+
+/* E.chunkrows is a fenwick (binary indexed) tree over the number of rows in
+   each chunk so finding the chunk that holds a file row is O(log n).
+   E.chunklines is the same thing for the number of screen lines the rows
+   take up when they wrap, which is what mapping between the cursor's screen
+   line and a file row needs.  The trees are 1-based and are rebuilt whenever
+   chunks are split, merged or freed, which only happens once every few
+   hundred row inserts/deletes */
+
+void fenwickAdd(int *tree, int n, int i, int delta) {
+  for (i++; i <= n; i += i & -i) tree[i] += delta;
+}
+
+// the total of elements [0, i)
+int fenwickSum(int *tree, int i) {
+  int sum = 0;
+  for (; i > 0; i -= i & -i) sum += tree[i];
+  return sum;
+}
+
+// returns the element that contains position pos and sets *off to where pos is within it
+int fenwickFind(int *tree, int n, int pos, int *off) {
+  int i = 0;
+  int step = 1;
+  while (step * 2 <= n) step *= 2;
+  for (; step; step /= 2) {
+    if (i + step <= n && tree[i + step] <= pos) {
+      i += step;
+      pos -= tree[i];
+    }
+  }
+  *off = pos;
+  return i;
+}
+
+// turns tree[1..n] holding the plain values into a fenwick tree in O(n)
+void fenwickBuild(int *tree, int n) {
+  for (int i = 1; i <= n; i++) {
+    int j = i + (i & -i);
+    if (j <= n) tree[j] += tree[i];
+  }
+}
+
+// screen lines a row of size chars takes up - an empty row still takes a line
+int editorRowLines(int size) {
+  int lines = size/E.linecols;
+  if (size%E.linecols) lines++;
+  return lines ? lines : 1;
+}
+
+void rowStoreReindex(void) {
+  E.linegen++;
+  for (int i = 1; i <= E.numchunks; i++) {
+    E.chunks[i - 1]->idx = i - 1;
+    E.chunkrows[i] = E.chunks[i - 1]->numrows;
+    E.chunklines[i] = E.chunks[i - 1]->lines;
+  }
+  fenwickBuild(E.chunkrows, E.numchunks);
+  fenwickBuild(E.chunklines, E.numchunks);
+}
+
+// points a chunk's rows back at it and recounts its lines - for rows that were just moved into it
+void rowStoreAdopt(rowchunk *chunk) {
+  chunk->lines = 0;
+  chunk->bytes = 0;
+  for (int i = 0; i < chunk->numrows; i++) {
+    chunk->rows[i].chunk = chunk;
+    chunk->lines += editorRowLines(chunk->rows[i].size);
+    chunk->bytes += chunk->rows[i].size;
+  }
+}
+
+// the line counts depend on the screen width so they are redone if it changes
+void rowStoreCheckCols(void) {
+  if (E.linecols == E.screencols) return;
+  E.linecols = E.screencols;
+  for (int c = 0; c < E.numchunks; c++) rowStoreAdopt(E.chunks[c]);
+  rowStoreReindex();
+}
+
+// makes sure there is room in E.chunks and the trees for another chunk
+void rowStoreGrow(void) {
+  if (E.numchunks < E.chunkcap) return;
+  E.chunkcap = E.chunkcap ? 2 * E.chunkcap : 16;
+  E.chunks = realloc(E.chunks, sizeof(rowchunk *) * E.chunkcap);
+  E.chunkrows = realloc(E.chunkrows, sizeof(int) * (E.chunkcap + 1));
+  E.chunklines = realloc(E.chunklines, sizeof(int) * (E.chunkcap + 1));
+}
+
+void rowStoreAddChunk(int c) {
+  rowStoreGrow();
+  memmove(&E.chunks[c + 1], &E.chunks[c], sizeof(rowchunk *) * (E.numchunks - c));
+  E.chunks[c] = malloc(sizeof(rowchunk));
+  E.chunks[c]->numrows = 0;
+  E.chunks[c]->lines = 0;
+  E.chunks[c]->bytes = 0;
+  E.numchunks++;
+}
+
+/* adds a chunk to the end of the store - either a new empty one (chunk is
+   NULL) or one that was filled in elsewhere (see editorIndexStitch).  The
+   new tree node is the chunk's count plus the nodes it covers so appending
+   (reading in a file) doesn't rebuild the trees */
+void rowStoreAppendChunk(rowchunk *chunk) {
+  if (chunk == NULL) {
+    chunk = malloc(sizeof(rowchunk));
+    chunk->numrows = 0;
+    chunk->lines = 0;
+    chunk->bytes = 0;
+  }
+  rowStoreGrow();
+  int i = ++E.numchunks;
+  E.chunks[i - 1] = chunk;
+  chunk->idx = i - 1;
+  E.chunkrows[i] = chunk->numrows + fenwickSum(E.chunkrows, i - 1) - fenwickSum(E.chunkrows, i - (i & -i));
+  E.chunklines[i] = chunk->lines + fenwickSum(E.chunklines, i - 1) - fenwickSum(E.chunklines, i - (i & -i));
+  E.filerows += chunk->numrows;
+  E.linegen++;
+}
+
+void rowStoreRemoveChunk(int c) {
+  free(E.chunks[c]);
+  memmove(&E.chunks[c], &E.chunks[c + 1], sizeof(rowchunk *) * (E.numchunks - c - 1));
+  E.numchunks--;
+}
+
+erow *editorRow(int fr) {
+  int off;
+  int c = fenwickFind(E.chunkrows, E.numchunks, fr, &off);
+  return &E.chunks[c]->rows[off];
+}
+
+// the file row of a row in the store - the reverse of editorRow
+int editorRowIndex(erow *row) {
+  return fenwickSum(E.chunkrows, row->chunk->idx) + (row - row->chunk->rows);
+}
+
+// where file row fr starts in the saved file - rows before it plus their newlines
+long long editorRowOffset(int fr) {
+  int off;
+  int c = fenwickFind(E.chunkrows, E.numchunks, fr, &off);
+  long long pos = fenwickSum(E.chunkrows, c) + off;
+  for (int i = 0; i < c; i++) pos += E.chunks[i]->bytes;
+  for (int i = 0; i < off; i++) pos += E.chunks[c]->rows[i].size;
+  return pos;
+}
+
+// has to be called by anything that changes row->size so the line counts stay right
+void editorRowResized(erow *row, int oldsize) {
+  row->chunk->bytes += row->size - oldsize;
+  int delta = editorRowLines(row->size) - editorRowLines(oldsize);
+  if (delta == 0) return;
+  E.linegen++;
+  row->chunk->lines += delta;
+  fenwickAdd(E.chunklines, E.numchunks, row->chunk->idx, delta);
+}
+
+// the screen line (counting from the top of the file) that file row fr starts on
+int editorRowScreenLine(int fr) {
+  int off;
+  rowStoreCheckCols();
+  int c = fenwickFind(E.chunkrows, E.numchunks, fr, &off);
+  int line = fenwickSum(E.chunklines, c);
+  for (int i = 0; i < off; i++) line += editorRowLines(E.chunks[c]->rows[i].size);
+  return line;
+}
+
+// the file row that screen line y (counting from the top of the file) is part of - E.filerows if it's past the last row
+int editorScreenLineRow(int y) {
+  int off;
+  rowStoreCheckCols();
+  int c = fenwickFind(E.chunklines, E.numchunks, y, &off);
+  if (c == E.numchunks) return E.filerows;
+  int fr = fenwickSum(E.chunkrows, c);
+  erow *row = E.chunks[c]->rows;
+  for (;;) {
+    int lines = editorRowLines(row->size);
+    if (off < lines) return fr;
+    off -= lines;
+    fr++;
+    row++;
+  }
+}
+
+/* makes room for a row at fr and returns it - the erow is empty apart from
+   size and chunk.  Note that any erow pointers into the chunk are invalid after this */
+erow *rowStoreInsert(int fr) {
+  int c, off;
+  rowchunk *chunk;
+
+  if (fr == E.filerows) {
+    // appending (which is what editorOpen does) starts a new chunk rather than splitting a full one
+    if (E.numchunks == 0 || E.chunks[E.numchunks - 1]->numrows == ROWS_PER_CHUNK)
+      rowStoreAppendChunk(NULL);
+    c = E.numchunks - 1;
+    off = E.chunks[c]->numrows;
+  } else c = fenwickFind(E.chunkrows, E.numchunks, fr, &off);
+
+  chunk = E.chunks[c];
+  if (chunk->numrows == ROWS_PER_CHUNK) {
+    // split the chunk and move the upper half of its rows into a new chunk
+    int half = ROWS_PER_CHUNK/2;
+    rowStoreAddChunk(c + 1);
+    E.chunks[c + 1]->numrows = ROWS_PER_CHUNK - half;
+    memcpy(E.chunks[c + 1]->rows, &chunk->rows[half], sizeof(erow) * (ROWS_PER_CHUNK - half));
+    chunk->numrows = half;
+    rowStoreAdopt(chunk);
+    rowStoreAdopt(E.chunks[c + 1]);
+    rowStoreReindex();
+    if (off > half) {
+      c++;
+      off -= half;
+      chunk = E.chunks[c];
+    }
+  }
+
+  memmove(&chunk->rows[off + 1], &chunk->rows[off], sizeof(erow) * (chunk->numrows - off));
+  chunk->numrows++;
+  chunk->lines++;
+  fenwickAdd(E.chunkrows, E.numchunks, c, 1);
+  fenwickAdd(E.chunklines, E.numchunks, c, 1);
+  E.filerows++;
+  E.linegen++;
+  chunk->rows[off].size = 0;
+  chunk->rows[off].chunk = chunk;
+  return &chunk->rows[off];
+}
+
+// removes the row at fr from the store - freeing its chars is up to the caller
+void rowStoreDelete(int fr) {
+  int off;
+  int c = fenwickFind(E.chunkrows, E.numchunks, fr, &off);
+  rowchunk *chunk = E.chunks[c];
+  int lines = editorRowLines(chunk->rows[off].size);
+  chunk->bytes -= chunk->rows[off].size;
+
+  memmove(&chunk->rows[off], &chunk->rows[off + 1], sizeof(erow) * (chunk->numrows - off - 1));
+  chunk->numrows--;
+  chunk->lines -= lines;
+  E.filerows--;
+  E.linegen++;
+
+  if (chunk->numrows == 0) {
+    rowStoreRemoveChunk(c);
+    rowStoreReindex();
+  } else if (c + 1 < E.numchunks && chunk->numrows + E.chunks[c + 1]->numrows <= ROWS_PER_CHUNK/2) {
+    // merge sparse neighbors so deleting lots of rows doesn't leave lots of nearly empty chunks
+    memcpy(&chunk->rows[chunk->numrows], E.chunks[c + 1]->rows, sizeof(erow) * E.chunks[c + 1]->numrows);
+    chunk->numrows += E.chunks[c + 1]->numrows;
+    rowStoreAdopt(chunk);
+    rowStoreRemoveChunk(c + 1);
+    rowStoreReindex();
+  } else {
+    fenwickAdd(E.chunkrows, E.numchunks, c, -1);
+    fenwickAdd(E.chunklines, E.numchunks, c, -lines);
+  }
+}
+
+void editorFreeRow(erow *row);
+
+void rowStoreClear(void) {
+  for (int c = 0; c < E.numchunks; c++) {
+    for (int i = 0; i < E.chunks[c]->numrows; i++) editorFreeRow(&E.chunks[c]->rows[i]);
+    free(E.chunks[c]);
+  }
+  E.numchunks = 0;
+  E.filerows = 0;
+  rowStoreReindex();
+}
+
+/*** piece table ***/
+
+/* With E.piecetable on, editorOpen reads the whole file into E.orig and each
+   row is just a pointer into it (row->piece) - nothing is copied per line.
+   Rows inserted later (newline, paste, undo) have their text appended to the
+   add buffer which, like E.orig, is never modified.  A row only gets its own
+   malloc'd gap buffer (editorRowMaterialize) when it is edited or when
+   something needs it as a '\0' terminated string. */
+
+const char *editorAddText(const char *s, size_t len) {
+  if (len == 0) return "";
+  addblock *b = E.addbuf;
+  if (b == NULL || b->cap - b->len < len) {
+    size_t cap = (len > ADDBLOCK_SIZE) ? len : ADDBLOCK_SIZE;
+    b = malloc(sizeof(addblock) + cap);
+    b->next = E.addbuf;
+    b->len = 0;
+    b->cap = cap;
+    E.addbuf = b;
+  }
+  char *p = &b->text[b->len];
+  memcpy(p, s, len);
+  b->len += len;
+  return p;
+}
+
+void editorRowSetPiece(erow *row, const char *s, int len) {
+  int oldsize = row->size;
+  row->size = len;
+  row->chars = NULL;
+  row->gap = row->gaplen = 0;
+  row->piece = s;
+  editorRowResized(row, oldsize);
+}
+
+// gives a piece row its own gap buffer so it can be edited
+void editorRowMaterialize(erow *row) {
+  if (row->chars) return;
+  row->chars = malloc(row->size + 1);
+  memcpy(row->chars, row->piece, row->size);
+  row->chars[row->size] = '\0';
+  row->gap = row->size;
+  row->gaplen = 0;
+  row->piece = NULL;
+}
+
+/*** undo journal ***/
+
+/* Rather than copying the whole file before every command, each change is
+   recorded as it is made by the row operations below: spans of text
+   inserted into or deleted from a row and whole rows inserted or deleted.
+   editorCreateSnapshot, called before each editing command, now just marks
+   that the next change starts a new group.  The groups make a tree (see
+   undogroup): 'u' reverses the current group's records and moves to its
+   parent, CTRL-R goes back down to the child last undone, and g-/g+ and
+   :earlier/:later get to any group by when it was made.  Nothing is thrown
+   away until the journal outgrows E.undomax - see editorUndoTrim. */
+
+#define UNDO_MEM_DEFAULT (64*1024*1024)
+
+// forgets all undo history - after a file is read in for instance
+void editorUndoClear(void) {
+  for (int i = 0; i < E.undolen; i++)
+    if (!E.undo[i].shared) free(E.undo[i].text);
+  E.undolen = 0;
+  E.undomem = 0;
+  if (E.groupcap == 0) {
+    E.groupcap = 64;
+    E.undogroups = malloc(sizeof(undogroup) * E.groupcap);
+  }
+  E.undogroups[0] = (undogroup){0, 0, -1, -1, 0, time(NULL)};
+  E.numgroups = 1;
+  E.curgroup = 0;
+  E.newgroup = 0;
+  E.lastseq = 0;
+}
+
+// starts a group for the next command's changes as a child of the current one
+void editorUndoNewGroup(void) {
+  if (E.undomem > E.undomax) editorUndoTrim();
+  if (E.numgroups == E.groupcap) {
+    E.groupcap *= 2;
+    E.undogroups = realloc(E.undogroups, sizeof(undogroup) * E.groupcap);
+  }
+  undogroup *g = &E.undogroups[E.numgroups];
+  g->start = E.undolen;
+  g->len = 0;
+  g->parent = E.curgroup;
+  g->lastchild = -1;
+  g->seq = ++E.lastseq;
+  g->time = time(NULL);
+  E.undogroups[E.curgroup].lastchild = E.numgroups;
+  E.curgroup = E.numgroups++;
+  E.newgroup = 0;
+}
+
+// adds a record to the journal for the caller to fill in the text of - NULL while replaying
+undorec *editorJournalAdd(int type, int fr, int at, const char *text, int len) {
+  if (fr < E.changedrow) E.changedrow = fr; //undo and redo count too
+  editorSwapLog(type, fr, at, text, len);
+  editorMatchesChanged(type, fr);
+  if (E.replaying) return NULL;
+
+  if (E.numgroups == 0) editorUndoClear(); //a change before there's any history
+  // a group's records have to stay together at the end of the journal to be added to
+  undogroup *g = &E.undogroups[E.curgroup];
+  if (E.newgroup || E.curgroup == 0 || g->start + g->len != E.undolen) editorUndoNewGroup();
+
+  if (E.undolen == E.undocap) {
+    E.undocap = E.undocap ? 2 * E.undocap : 256;
+    E.undo = realloc(E.undo, sizeof(undorec) * E.undocap);
+  }
+  undorec *u = &E.undo[E.undolen++];
+  u->type = type;
+  u->fr = fr;
+  u->at = at;
+  u->len = len;
+  u->text = NULL;
+  u->shared = 0;
+  E.undogroups[E.curgroup].len++;
+  E.undomem += sizeof(undorec);
+  return u;
+}
+
+void editorJournal(int type, int fr, int at, const char *text, int len) {
+  undorec *u = editorJournalAdd(type, fr, at, text, len);
+  if (u && len) {
+    u->text = malloc(len);
+    memcpy(u->text, text, len);
+    E.undomem += len;
+  }
+}
+
+// for text in the original file or the add buffer - the record just points at it
+void editorJournalShared(int type, int fr, int at, const char *text, int len) {
+  undorec *u = editorJournalAdd(type, fr, at, text, len);
+  if (u) {
+    u->text = (char *)text;
+    u->shared = 1;
+  }
+}
+
+/* the tail of the file is about to be rewritten under the mapping (see
+   editorSaveTail) so records sharing text from there on get their own copy
+   of it in the add buffer */
+void editorUndoUnshare(const char *from, const char *to) {
+  for (int i = 0; i < E.undolen; i++) {
+    undorec *u = &E.undo[i];
+    if (u->shared && u->text >= from && u->text < to)
+      u->text = (char *)editorAddText(u->text, u->len);
+  }
+}
+
+/*** undo file ***/
+
+/* the undo journal is kept across sessions in .name.un~ next to the file.
+   It's written by the save thread once the file itself is written: a header
+   with a hash of the saved file, the undo tree's groups, the records and then
+   their text.  When the file is opened again the undo file is mapped and the
+   records just point at their text in the mapping (like shared text, it's
+   never freed), so old history costs a record each and nothing more.  The
+   hash is only checked against the file as it was read (E.orig) the first
+   time the old history is used or is about to be saved again - hashing a big
+   file on every open would undo the point of mapping it lazily */
+#define UNDO_MAGIC "kiloun02"
+
+typedef struct undoheader {
+  char magic[8];
+  unsigned long long hash; //editorHash of the file the history ends at
+  long long size; //and its size
+  int numrecs, numgroups, curgroup, lastseq;
+} undoheader;
+
+typedef struct undofilerec {
+  int type, fr, at, len;
+  long long off; //where the text is, counting from the end of the records
+} undofilerec;
+
+struct {
+  // the journal as it was when the save started - written out by the save thread
+  char *path;
+  char *meta; //header, groups and records
+  size_t metalen;
+  char *copy; //text of the records that own theirs
+  struct iovec *iov; //meta and then the text of every record
+  int niov;
+  // history read in from the undo file
+  int loaded; //groups at the start of the journal from the undo file that haven't been checked
+  unsigned long long hash;
+} undofile;
+
+unsigned long long editorHash(const char *p, size_t len) {
+  unsigned long long h = 1469598103934665603ULL ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    unsigned long long w;
+    memcpy(&w, &p[i], 8);
+    h = (h ^ w) * 1099511628211ULL;
+    h ^= h >> 29;
+  }
+  for (; i < len; i++) h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+  return h;
+}
+
+// hashes the file at path - returns -1 if it can't be read
+int editorHashFile(const char *path, unsigned long long *hash, long long *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return -1;
+  struct stat st;
+  int r = -1;
+  if (fstat(fd, &st) == 0) {
+    *size = st.st_size;
+    if (st.st_size == 0) {
+      *hash = editorHash(NULL, 0);
+      r = 0;
+    } else {
+      char *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        *hash = editorHash(p, st.st_size);
+        munmap(p, st.st_size);
+        r = 0;
+      }
+    }
+  }
+  close(fd);
+  return r;
+}
+
+// the name of a file that goes with file - .name.suffix in the same directory
+char *editorSidecar(const char *file, const char *suffix) {
+  const char *slash = strrchr(file, '/');
+  int dirlen = slash ? slash - file + 1 : 0;
+  char *path = malloc(strlen(file) + strlen(suffix) + 3);
+  sprintf(path, "%.*s.%s.%s", dirlen, file, &file[dirlen], suffix);
+  return path;
+}
+
+/* makes sure history read from the undo file goes with the file - if it
+   doesn't, all of it is thrown away. returns 0 then */
+int editorUndoVerify(void) {
+  if (undofile.loaded == 0) return 1;
+  undofile.loaded = 0;
+  if (E.piecetable && editorHash(E.orig, E.origlen) == undofile.hash) return 1;
+  editorUndoClear();
+  editorSetMessage("Undo file doesn't match the file - old history dropped");
+  return 0;
+}
+
+// checks the groups read from an undo file make a tree over the records
+int editorUndoTreeValid(undogroup *groups, int numgroups, int numrecs) {
+  for (int g = 0; g < numgroups; g++) {
+    undogroup *ug = &groups[g];
+    if (ug->start < 0 || ug->len < 0 || ug->start > numrecs - ug->len) return 0;
+    if (g == 0 ? ug->parent != -1 : (ug->parent < 0 || ug->parent >= g)) return 0;
+    if (ug->lastchild != -1 && (ug->lastchild <= g || ug->lastchild >= numgroups || groups[ug->lastchild].parent != g)) return 0;
+  }
+  return 1;
+}
+
+void editorUndoLoad(void) {
+  if (E.filename == NULL) return;
+  char *path = editorSidecar(E.filename, "un~");
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1) return;
+  struct stat st;
+  char *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(undoheader))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return;
+
+  undoheader h;
+  memcpy(&h, map, sizeof(h));
+  size_t metalen = sizeof(h) + sizeof(undogroup) * (size_t)h.numgroups + sizeof(undofilerec) * (size_t)h.numrecs;
+  if (memcmp(h.magic, UNDO_MAGIC, 8) != 0 || h.size != E.disk.st_size || h.numrecs < 0 ||
+      h.numgroups < 1 || h.curgroup < 0 || h.curgroup >= h.numgroups || metalen > (size_t)st.st_size ||
+      !editorUndoTreeValid((undogroup *)(map + sizeof(h)), h.numgroups, h.numrecs)) {
+    munmap(map, st.st_size);
+    return;
+  }
+  // -c has no copy of the file as it was read to check later so it's checked now
+  if (!E.piecetable) {
+    unsigned long long hash;
+    long long size;
+    if (editorHashFile(E.filename, &hash, &size) == -1 || hash != h.hash) {
+      munmap(map, st.st_size);
+      return;
+    }
+  }
+
+  undogroup *groups = (undogroup *)(map + sizeof(h));
+  undofilerec *recs = (undofilerec *)(groups + h.numgroups);
+  char *text = map + metalen;
+  long long textlen = st.st_size - metalen;
+  editorUndoClear();
+  E.undocap = h.numrecs ? h.numrecs : 1;
+  E.undo = realloc(E.undo, sizeof(undorec) * E.undocap);
+  for (int i = 0; i < h.numrecs; i++) {
+    undofilerec *r = &recs[i];
+    if (r->type < U_ROW_INS || r->type > U_SPAN_DEL || r->fr < 0 || r->at < 0 ||
+        r->len < 0 || r->off < 0 || r->off > textlen - r->len) {
+      // a damaged undo file isn't worth anything - replaying a record like that would crash
+      E.undolen = 0;
+      editorUndoClear();
+      munmap(map, st.st_size);
+      return;
+    }
+    undorec *u = &E.undo[E.undolen++];
+    u->type = r->type;
+    u->fr = r->fr;
+    u->at = r->at;
+    u->len = r->len;
+    u->text = &text[r->off];
+    u->shared = 1;
+  }
+  E.undomem = sizeof(undorec) * E.undolen;
+  if (E.groupcap < h.numgroups) {
+    E.groupcap = h.numgroups;
+    E.undogroups = realloc(E.undogroups, sizeof(undogroup) * E.groupcap);
+  }
+  memcpy(E.undogroups, groups, sizeof(undogroup) * h.numgroups);
+  E.numgroups = h.numgroups;
+  E.curgroup = h.curgroup;
+  E.lastseq = h.lastseq;
+  undofile.loaded = E.piecetable ? h.numgroups : 0;
+  undofile.hash = h.hash;
+}
+
+// throws away what editorUndoImage made once the save is done with it
+void editorUndoImageFree(void) {
+  free(undofile.path);
+  free(undofile.meta);
+  free(undofile.copy);
+  free(undofile.iov);
+  undofile.path = undofile.meta = undofile.copy = NULL;
+  undofile.iov = NULL;
+  undofile.niov = 0;
+}
+
+/* lays out the undo file for the save of target - text that's shared is
+   pointed at where it is and only records that own their text (which could
+   be freed while the save runs) are copied */
+void editorUndoImage(const char *target) {
+  editorUndoImageFree();
+  undofile.path = editorSidecar(target, "un~");
+  if (E.numgroups <= 1) return; //nothing to keep - the old undo file is removed
+
+  undofile.metalen = sizeof(undoheader) + sizeof(undogroup) * E.numgroups + sizeof(undofilerec) * E.undolen;
+  undofile.meta = malloc(undofile.metalen);
+  undoheader *h = (undoheader *)undofile.meta;
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, UNDO_MAGIC, 8);
+  h->numrecs = E.undolen;
+  h->numgroups = E.numgroups;
+  h->curgroup = E.curgroup;
+  h->lastseq = E.lastseq;
+  undogroup *groups = (undogroup *)(undofile.meta + sizeof(undoheader));
+  memcpy(groups, E.undogroups, sizeof(undogroup) * E.numgroups);
+  undofilerec *recs = (undofilerec *)(groups + E.numgroups);
+
+  size_t copylen = 0;
+  for (int i = 0; i < E.undolen; i++)
+    if (!E.undo[i].shared) copylen += E.undo[i].len;
+  undofile.copy = malloc(copylen ? copylen : 1);
+  undofile.iov = malloc(sizeof(struct iovec) * (E.undolen + 1));
+  undofile.iov[0].iov_base = undofile.meta;
+  undofile.iov[0].iov_len = undofile.metalen;
+  undofile.niov = 1;
+
+  char *p = undofile.copy;
+  long long off = 0;
+  for (int i = 0; i < E.undolen; i++) {
+    undorec *u = &E.undo[i];
+    recs[i].type = u->type;
+    recs[i].fr = u->fr;
+    recs[i].at = u->at;
+    recs[i].len = u->len;
+    recs[i].off = off;
+    off += u->len;
+    if (u->len == 0) continue;
+    char *text = u->text;
+    if (!u->shared) {
+      memcpy(p, u->text, u->len);
+      text = p;
+      p += u->len;
+    }
+    struct iovec *last = &undofile.iov[undofile.niov - 1];
+    if ((char *)last->iov_base + last->iov_len == text) last->iov_len += u->len;
+    else {
+      undofile.iov[undofile.niov].iov_base = text;
+      undofile.iov[undofile.niov].iov_len = u->len;
+      undofile.niov++;
+    }
+  }
+}
+
+/* runs on the save thread once target has been written - the undo file is
+   written next to it and renamed into place. it's only a convenience so
+   failures just leave the old one (or none) */
+void editorUndoWrite(const char *target) {
+  if (undofile.path == NULL) return;
+  if (undofile.meta == NULL) {
+    unlink(undofile.path);
+    return;
+  }
+  undoheader *h = (undoheader *)undofile.meta;
+  if (editorHashFile(target, &h->hash, &h->size) == -1) return;
+
+  char *tmp = malloc(strlen(undofile.path) + 8);
+  sprintf(tmp, "%s.XXXXXX", undofile.path);
+  int fd = mkstemp(tmp);
+  if (fd == -1) {
+    free(tmp);
+    return;
+  }
+  struct iovec *iov = undofile.iov;
+  int cnt = undofile.niov;
+  int err = 0;
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt < 1024 ? cnt : 1024);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) {
+      err = 1;
+      break;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  if (close(fd) == -1) err = 1;
+  if (err || rename(tmp, undofile.path) == -1) unlink(tmp);
+  free(tmp);
+}
+
+// what group g's records take up
+size_t editorUndoGroupMem(undogroup *g) {
+  size_t mem = sizeof(undorec) * g->len;
+  for (int i = g->start; i < g->start + g->len; i++)
+    if (!E.undo[i].shared) mem += E.undo[i].len;
+  return mem;
+}
+
+/* gets the journal back under E.undomax - down to 3/4 of it so this doesn't
+   run again on the next command.  Branches off the way from the root to the
+   current group and on down its redo chain go first, oldest first.  If that
+   isn't enough the oldest groups before the current one are folded into the
+   root, which then stands for the file as it was after them: they can't be
+   undone any more but everything after them still can */
+void editorUndoTrim(void) {
+  size_t goal = E.undomax / 4 * 3;
+  size_t mem = E.undomem;
+  int n = E.numgroups;
+  char *keep = calloc(n, 1); //1 for the current group and its ancestors, 2 for its redo chain
+  char *drop = calloc(n, 1);
+  int *path = malloc(sizeof(int) * n);
+  int depth = 0;
+  for (int g = E.curgroup; g > 0; g = E.undogroups[g].parent) {
+    keep[g] = 1;
+    path[depth++] = g;
+  }
+  for (int g = E.undogroups[E.curgroup].lastchild; g != -1; g = E.undogroups[g].lastchild) keep[g] = 2;
+
+  // a group comes after its parent so a dropped branch goes all at once
+  for (int g = 1; g < n; g++) {
+    if (keep[g]) continue;
+    if (drop[E.undogroups[g].parent] || mem > goal) {
+      drop[g] = 1;
+      mem -= editorUndoGroupMem(&E.undogroups[g]);
+    }
+  }
+  int root = 0; //the last group folded into the root
+  while (mem > goal && depth > 0) {
+    root = path[--depth];
+    drop[root] = 1;
+    mem -= editorUndoGroupMem(&E.undogroups[root]);
+  }
+  int rootchild = E.undogroups[root].lastchild;
+  int rootseq = E.undogroups[root].seq; //the root takes the place of the last group folded into it
+  long long roottime = E.undogroups[root].time;
+
+  // squeeze out the dropped groups and their records - path becomes old index -> new
+  int numgroups = 0, undolen = 0, loaded = 0;
+  for (int g = 0; g < n; g++) {
+    undogroup *ug = &E.undogroups[g];
+    if (g > 0 && drop[g]) {
+      for (int i = ug->start; i < ug->start + ug->len; i++)
+        if (!E.undo[i].shared) free(E.undo[i].text);
+      continue;
+    }
+    path[g] = numgroups;
+    memmove(&E.undo[undolen], &E.undo[ug->start], sizeof(undorec) * ug->len);
+    ug->start = undolen;
+    undolen += ug->len;
+    if (g < undofile.loaded) loaded++;
+    E.undogroups[numgroups++] = *ug;
+  }
+  for (int g = 1; g < numgroups; g++) {
+    undogroup *ug = &E.undogroups[g];
+    ug->parent = drop[ug->parent] ? 0 : path[ug->parent]; //only folded groups are dropped with children kept
+    ug->lastchild = (ug->lastchild == -1 || drop[ug->lastchild]) ? -1 : path[ug->lastchild];
+  }
+  E.undogroups[0].lastchild = (rootchild == -1 || drop[rootchild]) ? -1 : path[rootchild];
+  E.undogroups[0].seq = rootseq;
+  E.undogroups[0].time = roottime;
+  E.curgroup = drop[E.curgroup] ? 0 : path[E.curgroup];
+  E.numgroups = numgroups;
+  E.undolen = undolen;
+  E.undomem = mem;
+  undofile.loaded = loaded;
+  free(keep);
+  free(drop);
+  free(path);
+}
+
 /*** row operations ***/
 
-//fr is the row number of the row to insert
-void editorInsertRow(int fr, char *s, size_t len) {
+/* each row's chars is a gap buffer: the text is chars[0, gap) followed by
+   chars[gap + gaplen, size + gaplen) and chars[size + gaplen] is always '\0'.
+   Typing at the cursor just fills in the gap so repeated inserts and deletes
+   at the same spot don't realloc or move the rest of the line.  Anything
+   that needs the row as a plain c-string calls editorRowChars, which moves
+   the gap to the end of the row */
+
+void editorRowSet(erow *row, char *s, size_t len) {
+  int oldsize = row->size;
+  row->size = len;
+  row->chars = malloc(len + 1);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0'; //each line is made into a c-string (maybe for searching)
+  row->gap = len;
+  row->gaplen = 0;
+  row->piece = NULL;
+  editorRowResized(row, oldsize);
+}
 
-  /*E.row is a pointer to an array of erow structures
-  The array of erows that E.row points to needs to have its memory enlarged when
-  you add a row. Note that erow structues are just a size and a char pointer*/
+void editorRowMoveGap(erow *row, int at) {
+  if (at < row->gap)
+    memmove(&row->chars[at + row->gaplen], &row->chars[at], row->gap - at);
+  else if (at > row->gap)
+    memmove(&row->chars[row->gap], &row->chars[row->gap + row->gaplen], at - row->gap);
+  row->gap = at;
+}
 
-  E.row = realloc(E.row, sizeof(erow) * (E.filerows + 1));
+// makes sure the gap can take len more chars - the buffer at least doubles when it grows
+void editorRowGrowGap(erow *row, int len) {
+  if (row->gaplen >= len) return;
+  int cap = 2 * (row->size + row->gaplen);
+  if (cap < row->size + len) cap = row->size + len;
+  if (cap < 16) cap = 16;
+  int gaplen = cap - row->size;
+  row->chars = realloc(row->chars, cap + 1);
+  // slide the text after the gap and the '\0' up to the end of the bigger buffer
+  memmove(&row->chars[row->gap + gaplen], &row->chars[row->gap + row->gaplen], row->size - row->gap + 1);
+  row->gaplen = gaplen;
+}
 
-  /*
-  memmove(dest, source, number of bytes to move?)
-  moves the line at fr to fr+1 and all the other erow structs until the end
-  when you insert into the last row E.filerows==fr then no memory is moved
-  apparently ok if there is no E.row[fr+1] if number of bytes = 0
-  so below we are moving the row structure currently at *fr* to x+1
-  and all the rows below *fr* to a new location to make room at *fr*
-  to create room for the line that we are inserting
-  */
+// returns the row as a contiguous '\0' terminated string
+char *editorRowChars(erow *row) {
+  editorRowMaterialize(row);
+  editorRowMoveGap(row, row->size);
+  row->chars[row->size] = '\0';
+  return row->chars;
+}
+
+// the text of a row - contiguous but not necessarily '\0' terminated
+const char *editorRowText(erow *row) {
+  if (row->chars == NULL) return row->piece;
+  editorRowMoveGap(row, row->size);
+  return row->chars;
+}
+
+// copies [start, start + len) of a row to dest without closing the gap
+void editorRowRead(erow *row, int start, int len, char *dest) {
+  if (row->chars == NULL) {
+    memcpy(dest, &row->piece[start], len);
+    return;
+  }
+  if (start < row->gap) {
+    int n = (start + len <= row->gap) ? len : row->gap - start;
+    memcpy(dest, &row->chars[start], n);
+    dest += n;
+    start += n;
+    len -= n;
+  }
+  if (len > 0) memcpy(dest, &row->chars[start + row->gaplen], len);
+}
+
+void editorRowInsertString(erow *row, int at, char *s, int len) {
+  if (at > row->size) at = row->size;
+  editorJournal(U_SPAN_INS, editorRowIndex(row), at, s, len);
+  editorRowMaterialize(row);
+  editorRowGrowGap(row, len);
+  editorRowMoveGap(row, at);
+  memcpy(&row->chars[at], s, len);
+  row->gap += len;
+  row->gaplen -= len;
+  row->size += len;
+  editorRowResized(row, row->size - len);
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {
+  char ch = c;
+  editorRowInsertString(row, at, &ch, 1);
+}
+
+// deleting just widens the gap - the memory is kept for the next insert
+void editorRowDelChars(erow *row, int at, int len) {
+  if (at < 0 || at >= row->size) return;
+  if (len > row->size - at) len = row->size - at;
+  char *text = NULL;
+  if (!E.replaying) {
+    text = malloc(len);
+    editorRowRead(row, at, len, text);
+  }
+  editorJournal(U_SPAN_DEL, editorRowIndex(row), at, text, len); //still notes the change when replaying
+  free(text);
+  if (row->chars == NULL && (at == 0 || at + len == row->size)) {
+    // trimming either end of a piece doesn't need a copy of the row
+    if (at == 0) row->piece += len;
+  } else {
+    editorRowMaterialize(row);
+    editorRowMoveGap(row, at);
+    row->gaplen += len;
+  }
+  row->size -= len;
+  editorRowResized(row, row->size + len);
+}
 
-  memmove(&E.row[fr + 1], &E.row[fr], sizeof(erow) * (E.filerows - fr));
+void editorRowDelChar(erow *row, int at) {
+  editorRowDelChars(row, at, 1);
+}
+
+void editorRowTruncate(erow *row, int at) {
+  editorRowDelChars(row, at, row->size - at);
+}
+
+// inserts a row that is s, which has to be in the original file or add buffer
+void editorInsertPiece(int fr, const char *s, size_t len) {
+  editorJournalShared(U_ROW_INS, fr, 0, s, len);
+  editorRowSetPiece(rowStoreInsert(fr), s, len);
+  E.dirty++;
+}
+
+//fr is the row number of the row to insert
+void editorInsertRow(int fr, char *s, size_t len) {
+  if (E.piecetable) {
+    editorInsertPiece(fr, editorAddText(s, len), len);
+    return;
+  }
+  editorJournal(U_ROW_INS, fr, 0, s, len);
 
   // section below creates an erow struct for the new row
-  E.row[fr].size = len;
-  E.row[fr].chars = malloc(len + 1);
-  memcpy(E.row[fr].chars, s, len);
-  E.row[fr].chars[len] = '\0'; //each line is made into a c-string (maybe for searching)
-  E.filerows++;
+  editorRowSet(rowStoreInsert(fr), s, len);
   E.dirty++;
 }
 
@@ -314,15 +1423,29 @@ void editorFreeRow(erow *row) {
   free(row->chars);
 }
 
+// takes row fr out of the file - editorDelRow also fixes up the cursor
+void editorRemoveRow(int fr) {
+  erow *row = editorRow(fr);
+  if (row->chars == NULL) editorJournalShared(U_ROW_DEL, fr, 0, row->piece, row->size);
+  else {
+    // the record takes over the row's buffer instead of copying it
+    undorec *u = editorJournalAdd(U_ROW_DEL, fr, 0, editorRowText(row), row->size);
+    if (u) {
+      u->text = row->chars;
+      row->chars = NULL;
+      E.undomem += row->size;
+    }
+  }
+  editorFreeRow(row);
+  rowStoreDelete(fr);
+}
+
 void editorDelRow(int fr) {
   //editorSetMessage("Row to delete = %d; E.filerows = %d", fr, E.filerows); 
   if (E.filerows == 0) return; // some calls may duplicate this guard
   int fc = editorGetFileCol();
-  editorFreeRow(&E.row[fr]); 
-  memmove(&E.row[fr], &E.row[fr + 1], sizeof(erow) * (E.filerows - fr - 1));
-  E.filerows--; 
+  editorRemoveRow(fr);
   if (E.filerows == 0) {
-    E.row = NULL;
     E.cy = 0;
     E.cx = 0;
   } else if (E.cy > 0) {
@@ -331,28 +1454,13 @@ void editorDelRow(int fr) {
     if (fr == E.filerows) E.cy--;
   }
   E.dirty++;
-  //editorSetMessage("Row deleted = %d; E.filerows after deletion = %d E.cx = %d E.row[fr].size = %d", fr, E.filerows, E.cx, E.row[fr].size); 
+  //editorSetMessage("Row deleted = %d; E.filerows after deletion = %d E.cx = %d editorRow(fr)->size = %d", fr, E.filerows, E.cx, editorRow(fr)->size); 
 }
 // only used by editorBackspace
 void editorRowAppendString(erow *row, char *s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  E.dirty++;
-}
-
-/* not in use right now
-void editorRowDelChar(erow *row, int fr) {
-  if (fr < 0 || fr >= row->size) return;
-  // is there any reason to realloc for one character?
-  // row->chars = realloc(row->chars, row->size -1); 
-  //have to realloc when adding but I guess no need to realloc for one character
-  memmove(&row->chars[fr], &row->chars[fr + 1], row->size - fr);
-  row->size--;
+  editorRowInsertString(row, row->size, s, len);
   E.dirty++;
 }
-*/
 
 /*** editor operations ***/
 void editorInsertChar(int c) {
@@ -362,23 +1470,12 @@ void editorInsertChar(int c) {
     editorInsertRow(0, "", 0); //editorInsertRow will insert '\0'
   }
 
-  erow *row = &E.row[editorGetFileRow()];
+  erow *row = editorRow(editorGetFileRow());
   int fc = editorGetFileCol();
 
 
   //if (E.cx < 0 || E.cx > row->size) E.cx = row->size; //can either of these be true? ie is check necessary?
-  row->chars = realloc(row->chars, row->size + 1); //******* was size + 2
-
-  /* moving all the chars fr the current x cursor position on char
-     farther down the char string to make room for the new character
-     Maybe a clue from editorInsertRow - it's memmove is below
-     memmove(&E.row[fr + 1], &E.row[fr], sizeof(erow) * (E.filerows - fr));
-  */
-
-  memmove(&row->chars[fc + 1], &row->chars[fc], row->size - fc); //****was E.cx + 1
-
-  row->size++;
-  row->chars[fc] = c;
+  editorRowInsertChar(row, fc, c);
   E.dirty++;
 
   if (E.cx >= E.screencols) {
@@ -388,6 +1485,54 @@ void editorInsertChar(int c) {
   E.cx++;
 }
 
+/* inserts text that may span lines at the cursor all in one go - used for
+   bracketed paste so a paste doesn't go through editorInsertChar and
+   editorInsertNewline (and their smart indenting) one byte at a time.
+   Leaves the cursor after the inserted text the way typing would */
+void editorInsertText(char *s, int len) {
+  if (E.filerows == 0) editorInsertRow(0, "", 0);
+
+  int fr = editorGetFileRow();
+  int fc = editorGetFileCol();
+  erow *row = editorRow(fr);
+  if (fc > row->size) fc = row->size;
+
+  char *end = s + len;
+  char *nl = memchr(s, '\n', len);
+  if (nl == NULL) {
+    editorRowInsertString(row, fc, s, len);
+    fc += len;
+  } else {
+    // the part of the row after the cursor ends up after the last pasted line
+    int taillen = row->size - fc;
+    char *p = nl + 1;
+    char *last;
+    nl = end;
+    while (nl > p && nl[-1] != '\n') nl--; //nl is now the start of the last pasted line
+    int lastlen = end - nl;
+    last = malloc(lastlen + taillen + 1);
+    memcpy(last, nl, lastlen);
+    editorRowRead(row, fc, taillen, &last[lastlen]);
+
+    editorRowTruncate(row, fc);
+    editorRowInsertString(row, fc, s, p - 1 - s);
+    while (p < nl) {
+      char *eol = memchr(p, '\n', nl - p);
+      editorInsertRow(++fr, p, eol - p);
+      p = eol + 1;
+    }
+    editorInsertRow(++fr, last, lastlen + taillen);
+    free(last);
+    fc = lastlen;
+  }
+  E.dirty++;
+
+  int line = editorRowScreenLine(fr) + (fc ? (fc - 1)/E.screencols : 0);
+  E.cy = line - E.rowoff;
+  E.cx = fc - (line - editorRowScreenLine(fr))*E.screencols;
+  E.continuation = 0;
+}
+
 /* uses VLA */
 void editorInsertNewline(int direction) {
   /* note this func does position cursor*/
@@ -403,7 +1548,7 @@ void editorInsertNewline(int direction) {
     return;
   }
     
-  erow *row = &E.row[editorGetFileRow()];
+  erow *row = editorRow(editorGetFileRow());
   int i;
   if (E.cx == 0 || E.cx == row->size) {
     if (E.smartindent) i = editorIndentAmount(editorGetFileRow());
@@ -434,10 +1579,9 @@ void editorInsertNewline(int direction) {
     E.cx = i;
   }
   else {
-    editorInsertRow(editorGetFileRow() + 1, &row->chars[editorGetFileCol()], row->size - editorGetFileCol());
-    row = &E.row[editorGetFileRow()];
-    row->size = editorGetFileCol();
-    row->chars[row->size] = '\0';
+    editorInsertRow(editorGetFileRow() + 1, &editorRowChars(row)[editorGetFileCol()], row->size - editorGetFileCol());
+    row = editorRow(editorGetFileRow());
+    editorRowTruncate(row, editorGetFileCol());
     if (E.smartindent) i = editorIndentAmount(E.cy);
     else i = 0;
 
@@ -447,133 +1591,2392 @@ void editorInsertNewline(int direction) {
     //  E.cy--;
     //}
 
-    E.cx = 0;
-    for (;;){
-      if (row->chars[0] != ' ') break;
-      editorDelChar();
+    E.cx = 0;
+    for (;;){
+      if (editorRowChars(row)[0] != ' ') break;
+      editorDelChar();
+    }
+
+  for ( int j=0; j < i; j++ ) editorInsertChar(' ');
+  E.cx = i;
+  }
+}
+
+void editorDelChar(void) {
+  if (E.filerows == 0) return;
+  erow *row = editorRow(editorGetFileRow());
+
+  /* row size = 1 means there is 1 char; size 0 means 0 chars */
+  /* Note that row->size does not count the terminating '\0' char*/
+  if (row->size == 0) return; 
+
+  int fc = editorGetFileCol();
+  if (fc >= row->size) fc = row->size - 1; //past the end of the row deletes the last char
+  editorRowDelChar(row, fc);
+
+  if (E.filerows == 1 && row->size == 0) {
+    editorRemoveRow(0);
+  }
+  else if (E.cx == row->size && E.cx) E.cx = row->size - 1;  // not sure what to do about this
+
+  E.dirty++;
+}
+
+void editorBackspace(void) {
+  if (E.cx == 0 && E.cy == 0) return;
+  int fc = editorGetFileCol();
+  int fr = editorGetFileRow();
+  erow *row = editorRow(fr);
+
+  if (E.cx > 0) {
+    editorRowDelChar(row, fc - 1);
+    if (E.cx == 1 && row->size/E.screencols && fc > row->size) E.continuation = 1; //right now only backspace in multi-line
+    E.cx--;
+  } else { //else E.cx == 0 and could be multiline
+    if (fc > 0) { //this means it's a multiline row and we're not at the top
+      editorRowDelChar(row, fc - 1);
+      E.cx = E.screencols - 1;
+      E.cy--;
+      E.continuation = 0;
+    } else {// this means we're at fc == 0 so we're in the first filecolumn
+      E.cx = (editorRow(fr - 1)->size/E.screencols) ? E.screencols : editorRow(fr - 1)->size ;
+      //if (E.cx < 0) E.cx = 0; //don't think this guard is necessary but we'll see
+      editorRowAppendString(editorRow(fr - 1), editorRowChars(row), row->size); //only use of this function
+      editorRemoveRow(fr);
+      E.cy--;
+    }
+  }
+  E.dirty++;
+}
+
+/*** file i/o ***/
+
+/* The piece table version of editorOpen maps the file (or reads it if it
+   can't be mapped) and the rows point into E.orig.  Splitting it into rows
+   is done lazily: editorScroll makes sure there are rows for the screen and
+   a screen beyond it, editorReadKey indexes the rest while it is waiting
+   for input and anything that needs the whole file (G, searching, saving)
+   calls editorIndexAll.  The rows that haven't been indexed yet always
+   follow the last row so they can just be appended when they are. */
+
+#define INDEX_CHUNK (4*1024*1024)
+
+/* Finding the newlines is done a block at a time: the scanner writes the
+   offset of every '\n' in the block to an array in one pass, comparing 16
+   or 32 bytes at once when the cpu has SSE2/AVX2 and turning the compare
+   mask into offsets, so short lines don't cost a memchr call each.  The
+   version used is picked the first time it's needed. */
+
+#define SCAN_BLOCK (64*1024)
+
+int scanNewlinesScalar(const char *p, int len, int *nls) {
+  int n = 0;
+  for (int i = 0; i < len; i++)
+    if (p[i] == '\n') nls[n++] = i;
+  return n;
+}
+
+#ifdef KILO_SIMD_X86
+__attribute__((target("sse2")))
+int scanNewlinesSSE2(const char *p, int len, int *nls) {
+  __m128i nl = _mm_set1_epi8('\n');
+  int i = 0, n = 0;
+  for (; i + 16 <= len; i += 16) {
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&p[i]), nl));
+    while (mask) {
+      nls[n++] = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  for (; i < len; i++)
+    if (p[i] == '\n') nls[n++] = i;
+  return n;
+}
+
+__attribute__((target("avx2")))
+int scanNewlinesAVX2(const char *p, int len, int *nls) {
+  __m256i nl = _mm256_set1_epi8('\n');
+  int i = 0, n = 0;
+  for (; i + 32 <= len; i += 32) {
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&p[i]), nl));
+    while (mask) {
+      nls[n++] = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  for (; i < len; i++)
+    if (p[i] == '\n') nls[n++] = i;
+  return n;
+}
+#endif
+
+int (*scanNewlines)(const char *p, int len, int *nls) = NULL;
+
+void scanNewlinesInit(void) {
+  scanNewlines = scanNewlinesScalar;
+#ifdef KILO_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) scanNewlines = scanNewlinesAVX2;
+  else if (__builtin_cpu_supports("sse2")) scanNewlines = scanNewlinesSSE2;
+#endif
+}
+
+// makes a row of [p, eol) with the same trimming of '\r's as the getline version
+void editorIndexLine(void *arg, char *p, char *eol) {
+  (void)arg;
+  while (eol > p && eol[-1] == '\r') eol--;
+  editorRowSetPiece(rowStoreInsert(E.filerows), p, eol - p);
+}
+
+/* splits [p, stop) into lines, going on to the end of the line that stop is
+   in, and calls line() for each one - returns where it got to.  nls has to
+   have room for SCAN_BLOCK offsets */
+char *scanLines(char *p, char *end, char *stop, int *nls, void (*line)(void *, char *, char *), void *arg) {
+  while (p < stop) {
+    int len = (end - p > SCAN_BLOCK) ? SCAN_BLOCK : end - p;
+    int n = scanNewlines(p, len, nls);
+    if (n == 0) {
+      // a line longer than a block (or the last line without a '\n')
+      char *nl = memchr(p + len, '\n', end - p - len);
+      line(arg, p, nl ? nl : end);
+      p = nl ? nl + 1 : end;
+      continue;
+    }
+    char *start = p;
+    for (int i = 0; i < n; i++) {
+      line(arg, p, start + nls[i]);
+      p = start + nls[i] + 1;
+    }
+    if (p < end && len == end - start) {
+      line(arg, p, end); //last line doesn't end with a '\n'
+      p = end;
+    }
+  }
+  return p;
+}
+
+/* Big files are indexed by a pool of threads as well.  The file is cut into
+   jobs at line boundaries and each worker takes the next job and builds
+   complete row chunks for it (the rows are just pieces so this only needs
+   E.orig).  The main thread then only has to add each job's chunks to the
+   end of the row store, in order, as editorIndexMore gets to them.  The
+   first job is small so the first screen doesn't wait on a big one. */
+
+#define PARALLEL_MIN (32*1024*1024) //files smaller than this are indexed on the main thread
+#define JOB_SIZE (16*1024*1024)
+#define FIRST_JOB_SIZE (1024*1024)
+#define MAX_INDEX_THREADS 16
+
+typedef struct indexjob {
+  char *start; //start and end of the job's lines in E.orig
+  char *end;
+  int linecols; //E.linecols the line counts were made with
+  rowchunk **chunks;
+  int numchunks;
+  int numrows;
+  int done;
+} indexjob;
+
+struct {
+  indexjob *jobs;
+  int numjobs;
+  int nextjob; //next job for a worker to take
+  int stitched; //jobs before this have been added to the row store
+  pthread_t threads[MAX_INDEX_THREADS];
+  int numthreads;
+  pthread_mutex_t lock;
+  pthread_cond_t jobdone;
+} indexer = {NULL, 0, 0, 0, {0}, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// line() for a worker - adds a row to the job's last chunk
+void indexJobLine(void *arg, char *p, char *eol) {
+  indexjob *job = arg;
+  while (eol > p && eol[-1] == '\r') eol--;
+  if (job->numchunks == 0 || job->chunks[job->numchunks - 1]->numrows == ROWS_PER_CHUNK) {
+    if ((job->numchunks & (job->numchunks - 1)) == 0) //grows at powers of 2
+      job->chunks = realloc(job->chunks, sizeof(rowchunk *) * (job->numchunks ? 2 * job->numchunks : 1));
+    rowchunk *chunk = malloc(sizeof(rowchunk));
+    chunk->numrows = 0;
+    chunk->lines = 0;
+    chunk->bytes = 0;
+    job->chunks[job->numchunks++] = chunk;
+  }
+  rowchunk *chunk = job->chunks[job->numchunks - 1];
+  erow *row = &chunk->rows[chunk->numrows++];
+  row->size = eol - p;
+  row->chars = NULL;
+  row->gap = row->gaplen = 0;
+  row->piece = p;
+  row->chunk = chunk;
+  int lines = row->size/job->linecols + (row->size%job->linecols ? 1 : 0);
+  chunk->lines += lines ? lines : 1;
+  chunk->bytes += row->size;
+  job->numrows++;
+}
+
+void *indexWorker(void *arg) {
+  (void)arg;
+  int *nls = malloc(sizeof(int) * SCAN_BLOCK);
+  for (;;) {
+    pthread_mutex_lock(&indexer.lock);
+    int j = indexer.nextjob < indexer.numjobs ? indexer.nextjob++ : -1;
+    pthread_mutex_unlock(&indexer.lock);
+    if (j == -1) break;
+
+    indexjob *job = &indexer.jobs[j];
+    scanLines(job->start, job->end, job->end, nls, indexJobLine, job);
+
+    pthread_mutex_lock(&indexer.lock);
+    job->done = 1;
+    pthread_cond_broadcast(&indexer.jobdone);
+    pthread_mutex_unlock(&indexer.lock);
+  }
+  free(nls);
+  return NULL;
+}
+
+// cuts E.orig into jobs and starts the workers - only worth it for big files
+void editorIndexStart(void) {
+  if (scanNewlines == NULL) scanNewlinesInit();
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (E.origlen < PARALLEL_MIN || cpus < 2) return;
+
+  char *end = E.orig + E.origlen;
+  char *p = E.orig;
+  indexer.jobs = malloc(sizeof(indexjob) * (E.origlen/JOB_SIZE + 2));
+  indexer.numjobs = 0;
+  while (p < end) {
+    // jobs end at the end of the line their nominal size reaches
+    size_t size = indexer.numjobs ? JOB_SIZE : FIRST_JOB_SIZE;
+    char *nl = ((size_t)(end - p) > size) ? memchr(p + size - 1, '\n', end - (p + size - 1)) : NULL;
+    indexjob *job = &indexer.jobs[indexer.numjobs++];
+    job->start = p;
+    job->end = nl ? nl + 1 : end;
+    job->linecols = E.linecols;
+    job->chunks = NULL;
+    job->numchunks = job->numrows = 0;
+    job->done = 0;
+    p = job->end;
+  }
+  indexer.nextjob = indexer.stitched = 0;
+
+  indexer.numthreads = (cpus > MAX_INDEX_THREADS) ? MAX_INDEX_THREADS : cpus;
+  for (int i = 0; i < indexer.numthreads; i++) {
+    if (pthread_create(&indexer.threads[i], NULL, indexWorker, NULL) != 0) {
+      indexer.numthreads = i; //the ones that did start will do all the jobs
+      break;
+    }
+  }
+  if (indexer.numthreads == 0) {
+    free(indexer.jobs);
+    indexer.jobs = NULL;
+    indexer.numjobs = 0;
+  }
+}
+
+// whether editorIndexMore can go ahead without waiting for a worker
+int editorIndexReady(void) {
+  if (indexer.stitched == indexer.numjobs) return 1;
+  pthread_mutex_lock(&indexer.lock);
+  int done = indexer.jobs[indexer.stitched].done;
+  pthread_mutex_unlock(&indexer.lock);
+  return done;
+}
+
+// adds the next job's chunks to the row store, waiting for it if need be
+void editorIndexStitch(void) {
+  indexjob *job = &indexer.jobs[indexer.stitched++];
+  pthread_mutex_lock(&indexer.lock);
+  while (!job->done) pthread_cond_wait(&indexer.jobdone, &indexer.lock);
+  pthread_mutex_unlock(&indexer.lock);
+
+  for (int i = 0; i < job->numchunks; i++) {
+    if (job->linecols != E.linecols) rowStoreAdopt(job->chunks[i]);
+    rowStoreAppendChunk(job->chunks[i]);
+  }
+  free(job->chunks);
+  E.indexed = job->end - E.orig;
+
+  if (indexer.stitched == indexer.numjobs) {
+    for (int i = 0; i < indexer.numthreads; i++) pthread_join(indexer.threads[i], NULL);
+    free(indexer.jobs);
+    indexer.jobs = NULL;
+    indexer.numjobs = indexer.stitched = indexer.numthreads = 0;
+  }
+}
+
+// splits about another bytes of E.orig into rows - always whole lines
+void editorIndexMore(size_t bytes) {
+  static int nls[SCAN_BLOCK];
+  if (indexer.numjobs) {
+    editorIndexStitch();
+    return;
+  }
+  char *p = E.orig + E.indexed;
+  char *end = E.orig + E.origlen;
+  char *stop = ((size_t)(end - p) > bytes) ? p + bytes : end;
+  if (scanNewlines == NULL) scanNewlinesInit();
+  p = scanLines(p, end, stop, nls, editorIndexLine, NULL);
+  E.indexed = p - E.orig;
+}
+
+// makes sure row fr exists if the file is that long
+void editorIndexTo(int fr) {
+  while (E.filerows <= fr && E.indexed < E.origlen) editorIndexMore(INDEX_CHUNK);
+}
+
+void editorIndexAll(void) {
+  while (E.indexed < E.origlen) editorIndexMore(E.origlen - E.indexed);
+}
+
+// indexes the rest of the file a chunk at a time until a key is pressed
+void editorIndexIdle(void) {
+  if (E.indexed == E.origlen) return;
+  while (E.indexed < E.origlen) {
+    fd_set fds;
+    // if the next job isn't done yet, wait for it a little at a time while watching for input
+    struct timeval tv = {0, editorIndexReady() ? 0 : 10000};
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0) return;
+    if (editorIndexReady()) editorIndexMore(INDEX_CHUNK);
+  }
+  editorRefreshScreen(); //the status bar has the number of lines
+}
+
+void editorOpenPieces(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) die("fstat");
+  E.origlen = st.st_size;
+  E.indexed = 0;
+  if (E.origlen == 0) return;
+
+  E.orig = mmap(NULL, E.origlen, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (E.orig != MAP_FAILED) {
+    E.origmapped = 1;
+    return;
+  }
+
+  // not something that can be mapped so read it in
+  E.orig = malloc(E.origlen + 1);
+  size_t got = 0;
+  while (got < E.origlen) {
+    ssize_t n = read(fd, &E.orig[got], E.origlen - got);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) break;
+    got += n;
+  }
+  E.origlen = got; //in case the file shrank
+}
+
+void editorOpen(char *filename) {
+  free(E.filename);
+  E.filename = strdup(filename);
+  if (stat(filename, &E.disk) == -1) E.disk.st_ino = 0;
+
+  if (E.piecetable) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+    editorOpenPieces(fd);
+    editorIndexStart();
+    close(fd);
+    E.dirty = 0;
+    E.disklines = -1;
+    return;
+  }
+
+  FILE *fp = fopen(filename, "r");
+  if (!fp) die("fopen");
+
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  E.disklines = 1;
+  while ((linelen = getline(&line, &linecap, fp)) != -1) {
+    if (line[linelen - 1] != '\n' || (linelen > 1 && line[linelen - 2] == '\r')) E.disklines = 0;
+    while (linelen > 0 && (line[linelen - 1] == '\n' ||
+                           line[linelen - 1] == '\r'))
+      linelen--;
+    editorInsertRow(E.filerows, line, linelen);
+  }
+  free(line);
+  fclose(fp);
+  E.dirty = 0;
+}
+
+/* fsyncs the directory holding path so the rename itself is on disk */
+void editorSyncDir(const char *path) {
+  char *dir = strdup(path);
+  char *slash = strrchr(dir, '/');
+  if (slash == dir) slash[1] = '\0';
+  else if (slash) *slash = '\0';
+  else strcpy(dir, ".");
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  free(dir);
+}
+
+/* saves run on a thread of their own so a big file doesn't freeze the editor.
+   Before it starts, the document is snapshotted as a list of spans of text in
+   file order: rows that are still pieces point into the original file or the
+   add buffer, which are never changed or freed, so they cost nothing.  Only
+   rows with their own gap buffers are copied, and adjacent spans (an
+   unchanged stretch of the file with its newlines) are merged into one.  The
+   thread then writes the spans straight out with writev while editing goes
+   on.  The main thread polls it from editorReadKey, showing progress in the
+   message bar and finishing up once it's done.
+
+   When only the end of a big file has changed (E.changedrow) and the file on
+   disk is still the one that was read or last saved (E.disk), just the rows
+   from the first changed one on are written over the file in place and it's
+   truncated to the new length - see editorSaveTail.  :w! always rewrites the
+   whole file through a temp file */
+#define SAVE_IOVS 1024 //IOV_MAX on linux
+#define SAVE_PROGRESS (64*1024*1024) //bytes written between updates of the message bar
+#define SAVE_ASYNC_MIN (4*1024*1024) //smaller files are written before editorSave returns
+#define SAVE_TAIL_MAX (64*1024*1024) //biggest tail that's written in place
+
+struct {
+  struct iovec *segs; //the snapshot
+  int numsegs;
+  int segcap;
+  char *copy; //the text of rows that had their own gap buffers
+  long long start; //where in the file the spans go
+  long long total; //bytes in the spans
+  int dirty; //E.dirty when the snapshot was taken
+  int changedrow; //E.changedrow when the snapshot was taken
+  int inplace; //writing the tail over the file rather than a temp file
+  char *target; //the file being replaced and the temp file replacing it
+  char *tmp;
+  int fd;
+  struct stat written; //the file once it's been written
+  int running; //a save has been started and not finished up yet
+  int threaded;
+  pthread_t thread;
+  long long shown; //done when the message bar was last updated
+  pthread_mutex_t lock; //the three below are shared with the save thread
+  long long done; //bytes written so far
+  int finished;
+  int err; //errno when the save failed
+} saver = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void editorSaveAdd(const char *p, size_t len) {
+  if (len == 0) return;
+  if (saver.numsegs > 0) {
+    struct iovec *last = &saver.segs[saver.numsegs - 1];
+    if ((const char *)last->iov_base + last->iov_len == p) {
+      last->iov_len += len;
+      return;
+    }
+  }
+  if (saver.numsegs == saver.segcap) {
+    saver.segcap = saver.segcap ? saver.segcap * 2 : 64;
+    saver.segs = realloc(saver.segs, sizeof(struct iovec) * saver.segcap);
+  }
+  saver.segs[saver.numsegs].iov_base = (void *)p;
+  saver.segs[saver.numsegs].iov_len = len;
+  saver.numsegs++;
+}
+
+// snapshots the rows from file row from on - the file has to be fully indexed
+void editorSaveSnapshot(int from) {
+  static const char newline = '\n';
+  long long copylen = 0;
+  int j;
+  saver.total = 0;
+  for (j = from; j < E.filerows; j++) {
+    erow *row = editorRow(j);
+    saver.total += row->size + 1;
+    if (row->chars) copylen += row->size + 1;
+  }
+  saver.copy = malloc(copylen ? copylen : 1);
+  saver.numsegs = 0;
+
+  char *p = saver.copy;
+  for (j = from; j < E.filerows; j++) {
+    erow *row = editorRow(j);
+    if (row->chars == NULL) {
+      // a piece of the file that's followed by its newline goes out with it
+      int withnl = row->piece >= E.orig && row->piece + row->size < E.orig + E.origlen &&
+                   row->piece[row->size] == '\n';
+      editorSaveAdd(row->piece, row->size + withnl);
+      if (!withnl) editorSaveAdd(&newline, 1);
+    } else {
+      editorRowRead(row, 0, row->size, p);
+      p[row->size] = '\n';
+      editorSaveAdd(p, row->size + 1);
+      p += row->size + 1;
+    }
+  }
+  saver.changedrow = E.changedrow;
+  E.changedrow = INT_MAX;
+  editorSwapSaveStart();
+}
+
+// runs on the save thread - nothing here touches the editor state
+void *editorSaveWrite(void *arg) {
+  struct iovec *iov = saver.segs;
+  int cnt = saver.numsegs;
+  long long pos = saver.start;
+  int err = 0;
+  (void)arg;
+  while (cnt > 0) {
+    ssize_t n = pwritev(saver.fd, iov, cnt < SAVE_IOVS ? cnt : SAVE_IOVS, pos);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) {
+      err = n ? errno : EIO;
+      break;
+    }
+    pos += n;
+    pthread_mutex_lock(&saver.lock);
+    saver.done += n;
+    pthread_mutex_unlock(&saver.lock);
+    // partial writes pick up from the middle of the iovec they stopped in
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  if (!err && saver.inplace && ftruncate(saver.fd, pos) == -1) err = errno;
+  if (!err && fsync(saver.fd) == -1) err = errno;
+  if (!err) fstat(saver.fd, &saver.written);
+  if (close(saver.fd) == -1 && !err) err = errno;
+  if (!saver.inplace) {
+    if (!err && rename(saver.tmp, saver.target) == -1) err = errno;
+    if (err) unlink(saver.tmp);
+    else editorSyncDir(saver.target);
+  }
+  if (!err) editorUndoWrite(saver.target);
+
+  pthread_mutex_lock(&saver.lock);
+  saver.err = err;
+  saver.finished = 1;
+  pthread_mutex_unlock(&saver.lock);
+  return NULL;
+}
+
+void editorSaveFinish(void) {
+  if (saver.threaded) pthread_join(saver.thread, NULL);
+  free(saver.segs);
+  free(saver.copy);
+  free(saver.tmp);
+  free(saver.target);
+  saver.segs = NULL;
+  saver.copy = saver.tmp = saver.target = NULL;
+  saver.segcap = saver.numsegs = 0;
+  saver.running = 0;
+  editorUndoImageFree();
+  if (saver.err) {
+    if (saver.changedrow < E.changedrow) E.changedrow = saver.changedrow;
+    // a failed rename leaves the old file as it was but a failed write in place doesn't
+    if (saver.inplace) E.disk.st_ino = 0;
+    editorSwapSaved(0);
+    editorSetMessage("Can't save! I/O error: %s", strerror(saver.err));
+    return;
+  }
+  E.disk = saver.written;
+  E.disklines = 1; //every row was written with a '\n'
+  editorSwapSaved(1);
+  // edits made while the save was running are still unsaved
+  E.dirty -= saver.dirty;
+  if (E.dirty < 0) E.dirty = 0;
+  editorSetMessage("%lld bytes written to disk", saver.total);
+}
+
+// returns 1 when the message bar changed
+int editorSavePoll(void) {
+  if (!saver.running) return 0;
+  pthread_mutex_lock(&saver.lock);
+  int finished = saver.finished;
+  long long done = saver.done;
+  pthread_mutex_unlock(&saver.lock);
+  if (finished) {
+    editorSaveFinish();
+    return 1;
+  }
+  if (done - saver.shown < SAVE_PROGRESS) return 0;
+  saver.shown = done;
+  editorSetMessage("Saving... %d%%", (int)(done * 100 / saver.total));
+  return 1;
+}
+
+// blocks until a running save is done - before quitting or saving again
+void editorSaveWait(void) {
+  if (saver.running) editorSaveFinish();
+}
+
+void editorSaveBegin(char *target, char *tmp, int fd, long long start, int inplace) {
+  saver.target = target;
+  saver.tmp = tmp;
+  saver.fd = fd;
+  saver.start = start;
+  saver.inplace = inplace;
+  saver.done = saver.shown = 0;
+  saver.finished = saver.err = 0;
+  saver.dirty = E.dirty;
+  saver.running = 1;
+  saver.threaded = 0;
+  editorUndoImage(target);
+}
+
+/* starts the save thread - when the file is small or there's no thread it's
+   written before this returns */
+void editorSaveStart(void) {
+  saver.threaded = (saver.total >= SAVE_ASYNC_MIN || saver.inplace) &&
+                   pthread_create(&saver.thread, NULL, editorSaveWrite, NULL) == 0;
+  if (saver.threaded) {
+    editorSetMessage("Saving...");
+    return;
+  }
+  editorSaveWrite(NULL);
+  editorSaveFinish();
+}
+
+/* writes the rows from E.changedrow on over the end of the file when that's
+   worth doing - returns 0 when the whole file should be saved instead */
+int editorSaveTail(char *target, struct stat *st) {
+  if (E.disk.st_ino == 0 || st->st_ino != E.disk.st_ino || st->st_dev != E.disk.st_dev ||
+      st->st_size != E.disk.st_size || st->st_mtim.tv_sec != E.disk.st_mtim.tv_sec ||
+      st->st_mtim.tv_nsec != E.disk.st_mtim.tv_nsec) return 0; //changed behind our back
+
+  /* where a row starts on disk is only the sum of the rows before it and
+     their newlines if every line ended in just '\n' - a file with "\r\n"
+     endings or no '\n' on the end is saved whole, and comes out with
+     plain ones so the next save can do the tail */
+  if (E.disklines == -1)
+    E.disklines = E.origlen == 0 || (E.orig[E.origlen - 1] == '\n' && memchr(E.orig, '\r', E.origlen) == NULL);
+  if (!E.disklines) return 0;
+
+  int fr = E.changedrow < E.filerows ? E.changedrow : E.filerows;
+  long long start = editorRowOffset(fr);
+  if (start < SAVE_ASYNC_MIN || editorRowOffset(E.filerows) - start > SAVE_TAIL_MAX) return 0;
+  int fd = open(target, O_WRONLY);
+  if (fd == -1) return 0;
+
+  /* the file may be the one that's mapped, so rows from fr on that still
+     point into the mapping would have their text rewritten under them - they
+     are moved to the add buffer, and the mapping is cut down to the part that
+     stays the same so nothing looks past the end of the file once it's truncated */
+  for (int j = fr; j < E.filerows; j++) {
+    erow *row = editorRow(j);
+    if (row->chars == NULL && row->piece >= E.orig && row->piece < E.orig + E.origlen)
+      editorRowSetPiece(row, editorAddText(row->piece, row->size), row->size);
+  }
+  if (E.orig) editorUndoUnshare(E.orig + start, E.orig + E.origlen); //nothing is mapped under -c
+  if ((long long)E.origlen > start) E.origlen = E.indexed = start;
+
+  editorSaveBegin(target, NULL, fd, start, 1);
+  editorSaveSnapshot(fr);
+  editorSaveStart();
+  return 1;
+}
+
+void editorSaveFile(int atomic) {
+  if (E.filename == NULL) return;
+  editorSaveWait();
+  editorUndoVerify(); //history from the undo file isn't saved again without being checked
+  editorIndexAll();
+
+  /* the new version is written to a temp file next to the original, synced
+     and renamed over it, so a crash leaves either the old file or the new
+     one and never half of each. it also leaves the old file alone when rows
+     still point into the mapping of it. a symlink is followed so the file
+     it points at gets replaced rather than the link */
+  char *target = realpath(E.filename, NULL);
+  if (target == NULL) target = strdup(E.filename);
+  struct stat st;
+  int exists = stat(target, &st) == 0;
+  if (exists && !atomic && editorSaveTail(target, &st)) return;
+
+  char *tmp = malloc(strlen(target) + 8);
+  sprintf(tmp, "%s.XXXXXX", target);
+  int fd = mkstemp(tmp);
+  if (fd == -1) {
+    editorSetMessage("Can't save! I/O error: %s", strerror(errno));
+    free(tmp);
+    free(target);
+    return;
+  }
+  if (exists) {
+    fchmod(fd, st.st_mode & 07777);
+    if (fchown(fd, st.st_uid, st.st_gid) == -1) {} //only root can give files away, keep ours
+  } else {
+    // a new file gets the usual 0666 less the umask rather than mkstemp's 0600
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+
+  editorSaveBegin(target, tmp, fd, 0, 0);
+  editorSaveSnapshot(0);
+  editorSaveStart();
+}
+
+void editorSave(void) {
+  editorSaveFile(0);
+}
+
+/*** swap file ***/
+
+/* every change that goes into the undo journal (undo and redo included) is
+   also appended to a swap file next to the file being edited, .name.swp, so
+   the edits made since the last save can be got back with -r after a crash.
+   Logging a change only copies it into swap.buf - a writer thread wakes up
+   every SWAP_INTERVAL ms, or sooner once SWAP_FLUSH bytes have piled up, and
+   does the write and fdatasync so a keystroke never waits on the disk.  The
+   file starts with a header saying which version of the file the changes go
+   on top of and is started over whenever the file is saved.  A swap file
+   that's already there when the file is opened without -r is another
+   session's or a crashed one's, so it's left alone and no swap is kept */
+#define SWAP_INTERVAL 200 //ms between writes
+#define SWAP_FLUSH (64*1024) //bytes logged that wake the writer early
+#define SWAP_MAGIC "kiloswp1"
+
+typedef struct swapheader {
+  char magic[8];
+  long long ino, size, mtime, mtimensec; //E.disk the changes apply to
+} swapheader;
+
+// the text follows for inserts - deletes only need the position
+typedef struct swaprec {
+  int type, fr, at, len;
+} swaprec;
+
+struct {
+  int fd; //-1 when no swap is kept
+  char *path;
+  int keep; //leave the swap file behind on exit (die)
+  pthread_t thread;
+  char *since; //changes logged while a background save is running
+  int sincelen;
+  int sincecap;
+  int saving;
+  pthread_mutex_t lock; //the ones below are shared with the writer
+  pthread_cond_t wake;
+  char *buf; //logged but not written yet
+  int len;
+  int cap;
+  int reset; //the file is to be started over with buf
+  int quit;
+} swap = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+void swapAppend(char **buf, int *len, int *cap, const void *p, int n) {
+  if (*len + n > *cap) {
+    *cap = *cap ? *cap * 2 : 4096;
+    if (*cap < *len + n) *cap = *len + n;
+    *buf = realloc(*buf, *cap);
+  }
+  memcpy(&(*buf)[*len], p, n);
+  *len += n;
+}
+
+// starts swap.buf over with a header for the file as it is on disk - swap.lock has to be held
+void editorSwapHeader(void) {
+  swapheader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SWAP_MAGIC, 8);
+  h.ino = E.disk.st_ino;
+  h.size = E.disk.st_size;
+  h.mtime = E.disk.st_mtim.tv_sec;
+  h.mtimensec = E.disk.st_mtim.tv_nsec;
+  swap.len = 0;
+  swapAppend(&swap.buf, &swap.len, &swap.cap, &h, sizeof(h));
+  swap.reset = 1;
+}
+
+void editorSwapLog(int type, int fr, int at, const char *text, int len) {
+  if (swap.fd == -1) return;
+  swaprec r = {type, fr, at, len};
+  int withtext = (type == U_ROW_INS || type == U_SPAN_INS);
+  pthread_mutex_lock(&swap.lock);
+  swapAppend(&swap.buf, &swap.len, &swap.cap, &r, sizeof(r));
+  if (withtext) swapAppend(&swap.buf, &swap.len, &swap.cap, text, len);
+  int full = swap.len >= SWAP_FLUSH;
+  pthread_mutex_unlock(&swap.lock);
+  if (full) pthread_cond_signal(&swap.wake);
+
+  if (swap.saving) {
+    swapAppend(&swap.since, &swap.sincelen, &swap.sincecap, &r, sizeof(r));
+    if (withtext) swapAppend(&swap.since, &swap.sincelen, &swap.sincecap, text, len);
+  }
+}
+
+void *editorSwapWriter(void *arg) {
+  char *spare = NULL;
+  int sparecap = 0;
+  off_t pos = 0;
+  (void)arg;
+  pthread_mutex_lock(&swap.lock);
+  for (;;) {
+    if (!swap.quit && swap.len < SWAP_FLUSH) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += SWAP_INTERVAL * 1000000L;
+      until.tv_sec += until.tv_nsec / 1000000000L;
+      until.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&swap.wake, &swap.lock, &until);
+    }
+    if (swap.len > 0 || swap.reset) {
+      // trade buffers so logging can go on while this one is written
+      char *out = swap.buf;
+      int outcap = swap.cap;
+      int len = swap.len;
+      int reset = swap.reset;
+      swap.buf = spare;
+      swap.cap = sparecap;
+      swap.len = 0;
+      swap.reset = 0;
+      spare = out;
+      sparecap = outcap;
+      pthread_mutex_unlock(&swap.lock);
+
+      if (reset) {
+        if (ftruncate(swap.fd, 0) == -1) {} //nothing to be done about it from here
+        pos = 0;
+      }
+      for (int done = 0; done < len;) {
+        ssize_t n = pwrite(swap.fd, &out[done], len - done, pos);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+        pos += n;
+      }
+      fdatasync(swap.fd);
+      pthread_mutex_lock(&swap.lock);
+    }
+    if (swap.quit && swap.len == 0 && !swap.reset) break;
+  }
+  pthread_mutex_unlock(&swap.lock);
+  free(spare);
+  return NULL;
+}
+
+// a save is starting from a snapshot - changes from now on go on top of the saved file
+void editorSwapSaveStart(void) {
+  swap.saving = 1;
+  swap.sincelen = 0;
+}
+
+// the save is done - when it worked the swap starts over from the new file
+void editorSwapSaved(int ok) {
+  swap.saving = 0;
+  if (!ok || swap.fd == -1) return;
+  pthread_mutex_lock(&swap.lock);
+  editorSwapHeader();
+  swapAppend(&swap.buf, &swap.len, &swap.cap, swap.since, swap.sincelen);
+  pthread_mutex_unlock(&swap.lock);
+  pthread_cond_signal(&swap.wake);
+}
+
+/* replays the changes in a swap file on top of the file just opened -
+   returns how many there were or -1 if it doesn't go with the file */
+int editorSwapReplay(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return -1;
+  struct stat st;
+  char *data = NULL;
+  ssize_t got = 0;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(swapheader)) {
+    data = malloc(st.st_size);
+    while (got < st.st_size) {
+      ssize_t n = read(fd, &data[got], st.st_size - got);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) break;
+      got += n;
+    }
+  }
+  close(fd);
+
+  swapheader h;
+  if (data == NULL || got < (ssize_t)sizeof(h)) {
+    free(data);
+    return -1;
+  }
+  memcpy(&h, data, sizeof(h));
+  if (memcmp(h.magic, SWAP_MAGIC, 8) != 0 || h.ino != (long long)E.disk.st_ino ||
+      h.size != E.disk.st_size || h.mtime != E.disk.st_mtim.tv_sec ||
+      h.mtimensec != E.disk.st_mtim.tv_nsec) {
+    free(data);
+    return -1;
+  }
+
+  // a crash can leave the last record half written so anything that doesn't fit or make sense ends it
+  int count = 0;
+  ssize_t p = sizeof(h);
+  editorIndexAll();
+  editorCreateSnapshot(); //the recovered changes can be undone as one
+  while (p + (ssize_t)sizeof(swaprec) <= got) {
+    swaprec r;
+    memcpy(&r, &data[p], sizeof(r));
+    p += sizeof(r);
+    int withtext = (r.type == U_ROW_INS || r.type == U_SPAN_INS);
+    if (r.len < 0 || r.fr < 0 || r.at < 0 || (withtext && r.len > got - p)) break;
+    if (r.type == U_ROW_INS) {
+      if (r.fr > E.filerows) break;
+      editorInsertRow(r.fr, &data[p], r.len);
+    } else {
+      if (r.fr >= E.filerows) break;
+      erow *row = editorRow(r.fr);
+      if (r.type == U_ROW_DEL) editorRemoveRow(r.fr);
+      else if (r.type == U_SPAN_INS && r.at <= row->size) editorRowInsertString(row, r.at, &data[p], r.len);
+      else if (r.type == U_SPAN_DEL && r.at < row->size) editorRowDelChars(row, r.at, r.len);
+      else break;
+    }
+    if (withtext) p += r.len;
+    count++;
+  }
+  free(data);
+  E.dirty += count;
+  return count;
+}
+
+void editorSwapClose(void) {
+  if (swap.fd == -1) return;
+  pthread_mutex_lock(&swap.lock);
+  swap.quit = 1;
+  pthread_mutex_unlock(&swap.lock);
+  pthread_cond_signal(&swap.wake);
+  pthread_join(swap.thread, NULL);
+  close(swap.fd);
+  swap.fd = -1;
+  if (!swap.keep) unlink(swap.path);
+}
+
+// a fatal error isn't a clean exit, so the swap stays for -r
+void editorSwapKeep(void) {
+  swap.keep = 1;
+}
+
+/* starts the swap file for E.filename, first replaying the one that's there
+   when recover is set (-r) */
+void editorSwapOpen(int recover) {
+  if (E.filename == NULL) return;
+  swap.path = editorSidecar(E.filename, "swp");
+
+  int recovered = 0;
+  char *old = NULL;
+  if (access(swap.path, F_OK) == 0) {
+    if (!recover) {
+      editorSetMessage("Found swap file %s - use -r to recover it", swap.path);
+      return;
+    }
+    // the changes get logged again as they're replayed so the old file is moved out of the way until that's done
+    old = malloc(strlen(swap.path) + 5);
+    sprintf(old, "%s.old", swap.path);
+    if (rename(swap.path, old) == -1) {
+      free(old);
+      return;
+    }
+  } else if (recover) editorSetMessage("No swap file to recover from");
+
+  swap.fd = open(swap.path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (swap.fd == -1) {
+    free(old);
+    return;
+  }
+  editorSwapHeader();
+  if (pthread_create(&swap.thread, NULL, editorSwapWriter, NULL) != 0) {
+    close(swap.fd);
+    unlink(swap.path);
+    swap.fd = -1;
+    free(old);
+    return;
+  }
+  atexit(editorSwapClose);
+
+  if (old) {
+    recovered = editorSwapReplay(old);
+    if (recovered == -1) {
+      // it doesn't go with the file - put it back for whoever it belongs to
+      editorSwapClose();
+      rename(old, swap.path);
+      editorSetMessage("Swap file %s doesn't match the file", swap.path);
+    } else {
+      unlink(old);
+      editorSetMessage("Recovered %d changes from %s", recovered, swap.path);
+    }
+    free(old);
+  }
+}
+
+/*** regex ***/
+
+/* Patterns typed at '/' (and so 'n', 'N' and :s) are regular expressions:
+   . [abc] [^a-z] * + ? | ( ) ^ $, \d \w \s and \D \W \S, and \ in front of
+   anything else to take it literally.  Nothing is ever matched by
+   backtracking so no pattern can make a search take more than linear time:
+   - a pattern is parsed to a tree and compiled to a program for a Thompson
+     NFA - forwards, and backwards for the DFA below
+   - searching runs each row backwards through a DFA made from the reversed
+     program, which is in a matching state at exactly the columns where a
+     match starts.  The DFA is built lazily, a state at a time as the text
+     needs it, in a cache of RE_MAX_STATES states that's thrown away and
+     started over if it fills up, so it can't take more than a fixed amount
+     of memory whatever the pattern
+   - most rows never get that far: if every match has to start with some
+     literal text, that's looked for with findSubstr first and only rows it
+     turns up in are run through the DFA
+   - :s needs to know where a match ends and what the groups matched.  The
+     same backwards pass also keeps, for each column, which characters of
+     the pattern could be read there and still lead to a match, and each
+     match is then followed forwards along the one way through the pattern
+     perl would pick (see reMatches) - so :s is linear in the row too */
+
+#define RE_MAX_STATES 1024 //DFA states cached - each one is about 1KB
+#define RE_MAX_GROUPS 9 //\1 to \9 in :s
+
+enum reOp {
+  RE_CHAR, //x is the class the character has to be in, y its number in the pattern
+  RE_SPLIT, //carry on at x and at y, x first
+  RE_JMP,
+  RE_SAVE, //the position goes in slot x
+  RE_BOL,
+  RE_EOL,
+  RE_MATCH
+};
+
+typedef struct reinst {
+  int op;
+  int x, y;
+} reinst;
+
+enum reNodeType { N_EMPTY, N_CHAR, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_GROUP, N_BOL, N_EOL };
+
+typedef struct renode {
+  int type;
+  int cls; //N_CHAR
+  int num; //N_CHAR - which character of the pattern it is
+  int group; //N_GROUP - 0 if it isn't captured
+  struct renode *a, *b;
+} renode;
+
+typedef struct regex {
+  reinst *prog; //forwards - for :s
+  int proglen;
+  reinst *rprog; //reversed - for the DFA
+  int rproglen;
+  unsigned char (*cls)[32]; //character classes as bitmaps
+  int numcls;
+  int numchars; //RE_CHARs in each program
+  int ngroups;
+  char prefix[256]; //every match starts with this
+  int prefixlen;
+  int literal; //the pattern is nothing but prefix
+  // while parsing and compiling
+  const char *p, *end;
+  const char *err;
+  renode **nodes;
+  int numnodes;
+  int progcap;
+} regex;
+
+renode *reNode(regex *re, int type, renode *a, renode *b) {
+  renode *n = calloc(1, sizeof(renode));
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  if (type == N_CHAR) n->num = re->numchars++;
+  if ((re->numnodes & (re->numnodes - 1)) == 0)
+    re->nodes = realloc(re->nodes, sizeof(renode *) * (re->numnodes ? 2 * re->numnodes : 1));
+  re->nodes[re->numnodes++] = n;
+  return n;
+}
+
+int reNewClass(regex *re) {
+  if ((re->numcls & (re->numcls - 1)) == 0)
+    re->cls = realloc(re->cls, 32 * (re->numcls ? 2 * re->numcls : 1));
+  memset(re->cls[re->numcls], 0, 32);
+  return re->numcls++;
+}
+
+void reClassAdd(unsigned char *bits, int lo, int hi) {
+  for (int c = lo; c <= hi; c++) bits[c >> 3] |= 1 << (c & 7);
+}
+
+int reClassHas(unsigned char *bits, int c) {
+  return bits[c >> 3] & (1 << (c & 7));
+}
+
+// \d \w \s and their opposites - 0 if e isn't one of them
+int reClassEscape(unsigned char *bits, int e) {
+  unsigned char tmp[32] = {0};
+  switch (tolower(e)) {
+    case 'd': reClassAdd(tmp, '0', '9'); break;
+    case 'w': reClassAdd(tmp, '0', '9'); reClassAdd(tmp, 'a', 'z'); reClassAdd(tmp, 'A', 'Z'); reClassAdd(tmp, '_', '_'); break;
+    case 's': reClassAdd(tmp, ' ', ' '); reClassAdd(tmp, '\t', '\r'); break;
+    default: return 0;
+  }
+  for (int i = 0; i < 32; i++) bits[i] |= isupper(e) ? ~tmp[i] : tmp[i];
+  return 1;
+}
+
+renode *reParseAlt(regex *re);
+
+// [...] - re->p is just past the '['
+renode *reParseClass(regex *re) {
+  int c = reNewClass(re);
+  unsigned char bits[32] = {0};
+  int negate = 0;
+  if (re->p < re->end && *re->p == '^') {
+    negate = 1;
+    re->p++;
+  }
+  int first = 1;
+  while (re->p < re->end && (*re->p != ']' || first)) {
+    first = 0;
+    int lo = (unsigned char)*re->p++;
+    if (lo == '\\' && re->p < re->end) {
+      lo = (unsigned char)*re->p++;
+      if (reClassEscape(bits, lo)) continue;
+    }
+    int hi = lo;
+    if (re->p + 1 < re->end && *re->p == '-' && re->p[1] != ']') {
+      hi = (unsigned char)re->p[1];
+      re->p += 2;
+      if (hi == '\\' && re->p < re->end) hi = (unsigned char)*re->p++;
+      if (hi < lo) {
+        re->err = "Bad range in []";
+        return NULL;
+      }
+    }
+    reClassAdd(bits, lo, hi);
+  }
+  if (re->p == re->end) {
+    re->err = "Missing ]";
+    return NULL;
+  }
+  re->p++;
+  for (int i = 0; i < 32; i++) re->cls[c][i] = negate ? ~bits[i] : bits[i];
+  renode *n = reNode(re, N_CHAR, NULL, NULL);
+  n->cls = c;
+  return n;
+}
+
+renode *reParseAtom(regex *re) {
+  int ch = (unsigned char)*re->p++;
+  renode *n;
+  switch (ch) {
+    case '(':
+      n = reNode(re, N_GROUP, NULL, NULL);
+      n->group = (re->ngroups < RE_MAX_GROUPS) ? ++re->ngroups : 0;
+      n->a = reParseAlt(re);
+      if (re->err) return NULL;
+      if (re->p == re->end || *re->p != ')') {
+        re->err = "Missing )";
+        return NULL;
+      }
+      re->p++;
+      return n;
+    case '[':
+      return reParseClass(re);
+    case '^':
+      return reNode(re, N_BOL, NULL, NULL);
+    case '$':
+      return reNode(re, N_EOL, NULL, NULL);
+    case '*':
+    case '+':
+    case '?':
+      re->err = "Nothing to repeat";
+      return NULL;
+  }
+  n = reNode(re, N_CHAR, NULL, NULL);
+  n->cls = reNewClass(re);
+  if (ch == '.') reClassAdd(re->cls[n->cls], 0, 255);
+  else if (ch == '\\') {
+    if (re->p == re->end) {
+      re->err = "Trailing \\";
+      return NULL;
+    }
+    ch = (unsigned char)*re->p++;
+    if (!reClassEscape(re->cls[n->cls], ch)) reClassAdd(re->cls[n->cls], ch, ch);
+  } else reClassAdd(re->cls[n->cls], ch, ch);
+  return n;
+}
+
+renode *reParseCat(regex *re) {
+  renode *cat = NULL;
+  while (re->p < re->end && *re->p != '|' && *re->p != ')') {
+    renode *n = reParseAtom(re);
+    if (re->err) return NULL;
+    while (re->p < re->end && (*re->p == '*' || *re->p == '+' || *re->p == '?')) {
+      int op = *re->p++;
+      n = reNode(re, op == '*' ? N_STAR : op == '+' ? N_PLUS : N_QUEST, n, NULL);
+    }
+    cat = cat ? reNode(re, N_CAT, cat, n) : n;
+  }
+  return cat ? cat : reNode(re, N_EMPTY, NULL, NULL);
+}
+
+renode *reParseAlt(regex *re) {
+  renode *n = reParseCat(re);
+  while (!re->err && re->p < re->end && *re->p == '|') {
+    re->p++;
+    renode *b = reParseCat(re);
+    if (re->err) return NULL;
+    n = reNode(re, N_ALT, n, b);
+  }
+  return n;
+}
+
+int reEmit(regex *re, reinst **prog, int *len, int op, int x, int y) {
+  if (*len == re->progcap) {
+    re->progcap = re->progcap ? 2 * re->progcap : 64;
+    *prog = realloc(*prog, sizeof(reinst) * re->progcap);
+  }
+  (*prog)[*len] = (reinst){op, x, y};
+  return (*len)++;
+}
+
+// compiles n to the end of prog - backwards (for matching the text right to left) when reverse is set
+void reCompileNode(regex *re, renode *n, reinst **prog, int *len, int reverse) {
+  int l1, l2;
+  switch (n->type) {
+    case N_EMPTY:
+      break;
+    case N_CHAR:
+      reEmit(re, prog, len, RE_CHAR, n->cls, n->num);
+      break;
+    case N_BOL:
+      reEmit(re, prog, len, reverse ? RE_EOL : RE_BOL, 0, 0);
+      break;
+    case N_EOL:
+      reEmit(re, prog, len, reverse ? RE_BOL : RE_EOL, 0, 0);
+      break;
+    case N_CAT:
+      reCompileNode(re, reverse ? n->b : n->a, prog, len, reverse);
+      reCompileNode(re, reverse ? n->a : n->b, prog, len, reverse);
+      break;
+    case N_ALT:
+      l1 = reEmit(re, prog, len, RE_SPLIT, 0, 0);
+      (*prog)[l1].x = *len;
+      reCompileNode(re, n->a, prog, len, reverse);
+      l2 = reEmit(re, prog, len, RE_JMP, 0, 0);
+      (*prog)[l1].y = *len;
+      reCompileNode(re, n->b, prog, len, reverse);
+      (*prog)[l2].x = *len;
+      break;
+    case N_STAR:
+      l1 = reEmit(re, prog, len, RE_SPLIT, 0, 0);
+      (*prog)[l1].x = *len;
+      reCompileNode(re, n->a, prog, len, reverse);
+      reEmit(re, prog, len, RE_JMP, l1, 0);
+      (*prog)[l1].y = *len;
+      break;
+    case N_PLUS:
+      l1 = *len;
+      reCompileNode(re, n->a, prog, len, reverse);
+      reEmit(re, prog, len, RE_SPLIT, l1, *len + 1);
+      break;
+    case N_QUEST:
+      l1 = reEmit(re, prog, len, RE_SPLIT, 0, 0);
+      (*prog)[l1].x = *len;
+      reCompileNode(re, n->a, prog, len, reverse);
+      (*prog)[l1].y = *len;
+      break;
+    case N_GROUP:
+      if (n->group && !reverse) reEmit(re, prog, len, RE_SAVE, 2 * n->group, 0);
+      reCompileNode(re, n->a, prog, len, reverse);
+      if (n->group && !reverse) reEmit(re, prog, len, RE_SAVE, 2 * n->group + 1, 0);
+      break;
+  }
+}
+
+// the literal text every match of n starts with goes on the end of re->prefix - returns 1 if that's all n can match
+int rePrefix(regex *re, renode *n) {
+  switch (n->type) {
+    case N_EMPTY:
+    case N_BOL:
+      return 1;
+    case N_CHAR: {
+      int ch = -1;
+      for (int c = 0; c < 256; c++) {
+        if (!reClassHas(re->cls[n->cls], c)) continue;
+        if (ch != -1) return 0; //more than one character
+        ch = c;
+      }
+      if (ch == -1 || re->prefixlen == (int)sizeof(re->prefix)) return 0;
+      re->prefix[re->prefixlen++] = ch;
+      return 1;
+    }
+    case N_CAT:
+      return rePrefix(re, n->a) && rePrefix(re, n->b);
+    case N_PLUS:
+      rePrefix(re, n->a); //at least once
+      return 0;
+    case N_GROUP:
+      return rePrefix(re, n->a);
+  }
+  return 0;
+}
+
+void reFree(regex *re) {
+  if (re == NULL) return;
+  free(re->prog);
+  free(re->rprog);
+  free(re->cls);
+  free(re);
+}
+
+// compiles pat - NULL with the reason in *err if it isn't a valid pattern
+regex *reCompile(const char *pat, int len, const char **err) {
+  regex *re = calloc(1, sizeof(regex));
+  re->p = pat;
+  re->end = pat + len;
+  renode *root = reParseAlt(re);
+  if (!re->err && re->p < re->end) re->err = "Unmatched )";
+  if (!re->err) {
+    re->progcap = 0;
+    reEmit(re, &re->prog, &re->proglen, RE_SAVE, 0, 0);
+    reCompileNode(re, root, &re->prog, &re->proglen, 0);
+    reEmit(re, &re->prog, &re->proglen, RE_SAVE, 1, 0);
+    reEmit(re, &re->prog, &re->proglen, RE_MATCH, 0, 0);
+    re->progcap = 0;
+    reCompileNode(re, root, &re->rprog, &re->rproglen, 1);
+    reEmit(re, &re->rprog, &re->rproglen, RE_MATCH, 0, 0);
+    rePrefix(re, root);
+    re->literal = re->prefixlen == len;
+    for (int i = 0; i < len; i++)
+      if (strchr(".[]()*+?|^$\\", pat[i])) re->literal = 0;
+  }
+  for (int i = 0; i < re->numnodes; i++) free(re->nodes[i]);
+  free(re->nodes);
+  re->nodes = NULL;
+  if (re->err) {
+    *err = re->err;
+    reFree(re);
+    return NULL;
+  }
+  return re;
+}
+
+/* The lazily built DFA.  A state is the set of NFA threads (RE_CHAR,
+   RE_EOL and RE_MATCH instructions of the reversed program) that are alive
+   after reading the text so far; where it goes on each byte is only worked
+   out the first time that byte turns up in that state. */
+
+typedef struct dfastate {
+  int *pcs;
+  int n;
+  unsigned hash;
+  int match; //a match starts here
+  int bolmatch; //a match starts here if it's the start of the row (a pattern starting with ^)
+} dfastate;
+
+typedef struct redfa {
+  regex *re;
+  dfastate *states;
+  int numstates;
+  int *next; //256 for each state, where it goes on each byte - -1 until it's been needed
+  int *table; //hash of a state's set -> index + 1, open addressing
+  int *mark; //for closures
+  int gen;
+  int *stack;
+  int *set; //scratch
+  int start; //the state at the end of the row - -1 until it's made
+  int empty; //a match fits in an empty row, where the start state is at both ends of it
+  int flushes;
+  int *starts; //for reStarts
+  int startcap;
+} redfa;
+
+#define RE_TABLE (2 * RE_MAX_STATES)
+
+redfa *reDfaNew(regex *re) {
+  redfa *d = calloc(1, sizeof(redfa));
+  d->re = re;
+  d->states = malloc(sizeof(dfastate) * RE_MAX_STATES);
+  d->next = malloc(sizeof(int) * 256 * RE_MAX_STATES);
+  d->table = calloc(RE_TABLE, sizeof(int));
+  d->mark = calloc(re->rproglen, sizeof(int));
+  d->stack = malloc(sizeof(int) * 2 * re->rproglen);
+  d->set = malloc(sizeof(int) * re->rproglen);
+  d->start = -1;
+  return d;
+}
+
+void reDfaFlush(redfa *d) {
+  for (int i = 0; i < d->numstates; i++) free(d->states[i].pcs);
+  d->numstates = 0;
+  memset(d->table, 0, sizeof(int) * RE_TABLE);
+  d->start = -1;
+  d->flushes++;
+}
+
+void reDfaFree(redfa *d) {
+  if (d == NULL) return;
+  reDfaFlush(d);
+  free(d->states);
+  free(d->next);
+  free(d->table);
+  free(d->mark);
+  free(d->stack);
+  free(d->set);
+  free(d->starts);
+  free(d);
+}
+
+/* adds the threads reachable from pc without reading anything to the set.
+   The scan goes right to left so the reversed program's RE_BOL holds at
+   the end of the row (atend) and its RE_EOL at the start (atstart) - an
+   RE_EOL that doesn't hold yet is kept in the set for bolmatch */
+void reDfaAdd(redfa *d, int pc, int atend, int atstart, int *n) {
+  reinst *prog = d->re->rprog;
+  int sp = 0;
+  d->stack[sp++] = pc;
+  while (sp) {
+    pc = d->stack[--sp];
+    if (d->mark[pc] == d->gen) continue;
+    d->mark[pc] = d->gen;
+    switch (prog[pc].op) {
+      case RE_JMP:
+        d->stack[sp++] = prog[pc].x;
+        break;
+      case RE_SPLIT:
+        d->stack[sp++] = prog[pc].y;
+        d->stack[sp++] = prog[pc].x;
+        break;
+      case RE_SAVE:
+        d->stack[sp++] = pc + 1;
+        break;
+      case RE_BOL:
+        if (atend) d->stack[sp++] = pc + 1;
+        break;
+      case RE_EOL:
+        if (atstart) d->stack[sp++] = pc + 1;
+        else d->set[(*n)++] = pc;
+        break;
+      default:
+        d->set[(*n)++] = pc;
+        break;
+    }
+  }
+}
+
+int reIntCmp(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+// the state for the n threads in d->set - made if it isn't in the cache
+int reDfaState(redfa *d, int n) {
+  qsort(d->set, n, sizeof(int), reIntCmp);
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++) h = (h ^ d->set[i]) * 16777619u;
+  int slot = h % RE_TABLE;
+  while (d->table[slot]) {
+    dfastate *s = &d->states[d->table[slot] - 1];
+    if (s->hash == h && s->n == n && memcmp(s->pcs, d->set, sizeof(int) * n) == 0) return d->table[slot] - 1;
+    slot = (slot + 1) % RE_TABLE;
+  }
+  if (d->numstates == RE_MAX_STATES) {
+    reDfaFlush(d);
+    return reDfaState(d, n);
+  }
+
+  dfastate *s = &d->states[d->numstates];
+  s->pcs = malloc(sizeof(int) * (n ? n : 1));
+  memcpy(s->pcs, d->set, sizeof(int) * n);
+  s->n = n;
+  s->hash = h;
+  s->match = s->bolmatch = 0;
+  for (int i = 0; i < n; i++)
+    if (d->re->rprog[s->pcs[i]].op == RE_MATCH) s->match = 1;
+  // would the RE_EOLs waiting in the set get to a match at the start of the row
+  int m = 0;
+  d->gen++;
+  for (int i = 0; i < n; i++)
+    if (d->re->rprog[s->pcs[i]].op == RE_EOL) reDfaAdd(d, s->pcs[i] + 1, 0, 1, &m);
+  for (int i = 0; i < m; i++)
+    if (d->re->rprog[d->set[i]].op == RE_MATCH) s->bolmatch = 1;
+  memset(&d->next[d->numstates << 8], -1, sizeof(int) * 256);
+  d->table[slot] = d->numstates + 1;
+  return d->numstates++;
+}
+
+int reDfaStart(redfa *d) {
+  if (d->start == -1) {
+    int n = 0;
+    d->gen++;
+    reDfaAdd(d, 0, 1, 1, &n);
+    d->empty = 0;
+    for (int i = 0; i < n; i++)
+      if (d->re->rprog[d->set[i]].op == RE_MATCH) d->empty = 1;
+    n = 0;
+    d->gen++;
+    reDfaAdd(d, 0, 1, 0, &n);
+    d->start = reDfaState(d, n);
+  }
+  return d->start;
+}
+
+// the state after state s reads c
+int reDfaNext(redfa *d, int s, unsigned char c) {
+  int t = d->next[s << 8 | c];
+  if (t >= 0) return t;
+  int n = 0;
+  d->gen++;
+  dfastate *st = &d->states[s];
+  for (int i = 0; i < st->n; i++) {
+    reinst *in = &d->re->rprog[st->pcs[i]];
+    if (in->op == RE_CHAR && reClassHas(d->re->cls[in->x], c)) reDfaAdd(d, st->pcs[i] + 1, 0, 0, &n);
+  }
+  reDfaAdd(d, 0, 0, 0, &n); //a match can end anywhere
+  int flushes = d->flushes;
+  t = reDfaState(d, n);
+  if (d->flushes == flushes) d->next[s << 8 | c] = t; //s is gone if the cache was thrown away
+  return t;
+}
+
+/* calls found() for every column in [from, len] of text where a match starts,
+   in order, until it returns 0 - returns 0 then too */
+int reStarts(redfa *d, const char *text, int len, int from, int (*found)(void *, int), void *arg) {
+  int n = 0;
+  int s = reDfaStart(d);
+  for (int p = len; ; p--) {
+    dfastate *st = &d->states[s];
+    if (st->match || (p == 0 && (st->bolmatch || (len == 0 && d->empty)))) {
+      if (n == d->startcap) {
+        d->startcap = d->startcap ? 2 * d->startcap : 64;
+        d->starts = realloc(d->starts, sizeof(int) * d->startcap);
+      }
+      d->starts[n++] = p;
+    }
+    if (p == from) break;
+    unsigned char c = text[p - 1];
+    int t = d->next[s << 8 | c];
+    s = (t >= 0) ? t : reDfaNext(d, s, c);
+  }
+  int r = 1;
+  for (int i = n - 1; i >= 0 && r; i--) r = found(arg, d->starts[i]);
+  return r;
+}
+
+/* every match in text[from, len] for :s - where it and each of its groups
+   start and end.  reStarts' pass back along the row also keeps, for each
+   column, which RE_CHARs were in the DFA's state there: the characters of
+   the pattern that could be read just before it and still lead on to a
+   match.  From each column a match starts at, the forward program is then
+   followed one character at a time, at each step taking the first way (in
+   the order perl tries them) that reads a character in that set, so no
+   thread is ever run that won't match and the row costs its length times
+   the size of the program however many matches it has */
+
+// the first RE_CHAR or RE_MATCH reachable from pc at p that can go on to a match - -1 if none
+int reWalk(regex *re, const char *text, int len, int p, unsigned *live, int pc, int *sub, int *mark, int gen) {
+  if (mark[pc] == gen) return -1;
+  mark[pc] = gen;
+  reinst *in = &re->prog[pc];
+  int r;
+  switch (in->op) {
+    case RE_JMP:
+      return reWalk(re, text, len, p, live, in->x, sub, mark, gen);
+    case RE_SPLIT:
+      r = reWalk(re, text, len, p, live, in->x, sub, mark, gen);
+      return r >= 0 ? r : reWalk(re, text, len, p, live, in->y, sub, mark, gen);
+    case RE_SAVE: {
+      int old = sub[in->x];
+      sub[in->x] = p;
+      r = reWalk(re, text, len, p, live, pc + 1, sub, mark, gen);
+      if (r < 0) sub[in->x] = old;
+      return r;
+    }
+    case RE_BOL:
+      return p == 0 ? reWalk(re, text, len, p, live, pc + 1, sub, mark, gen) : -1;
+    case RE_EOL:
+      return p == len ? reWalk(re, text, len, p, live, pc + 1, sub, mark, gen) : -1;
+    case RE_CHAR:
+      if (p < len && reClassHas(re->cls[in->x], (unsigned char)text[p]) && (live[in->y >> 5] >> (in->y & 31) & 1)) return pc;
+      return -1;
+  }
+  return pc; //RE_MATCH
+}
+
+/* calls found() with the groups of each match in text[from, len], left to
+   right, until it returns 0 - only the first match unless all is set.  An
+   empty match right where the last one ended doesn't count.  Returns the
+   number of matches found() was called for */
+int reMatches(redfa *d, const char *text, int len, int from, int all, int (*found)(void *, int *), void *arg) {
+  regex *re = d->re;
+  int words = re->numchars / 32 + 1;
+  int *at = malloc(sizeof(int) * (len - from + 1)); //the set each column's state has in sets
+  char *starts = malloc(len - from + 1);
+  unsigned *sets = NULL;
+  int numsets = 0, setcap = 0;
+  int ofstate[RE_MAX_STATES]; //where each state's set is - -1 if it hasn't been needed yet
+  memset(ofstate, -1, sizeof(ofstate));
+  int flushes = d->flushes;
+  int s = reDfaStart(d);
+  for (int p = len; ; p--) {
+    if (d->flushes != flushes) { //the states have been numbered over again
+      memset(ofstate, -1, sizeof(ofstate));
+      flushes = d->flushes;
+    }
+    dfastate *st = &d->states[s];
+    if (ofstate[s] == -1) {
+      if (numsets == setcap) {
+        setcap = setcap ? 2 * setcap : 16;
+        sets = realloc(sets, sizeof(unsigned) * words * setcap);
+      }
+      unsigned *set = &sets[numsets * words];
+      memset(set, 0, sizeof(unsigned) * words);
+      for (int i = 0; i < st->n; i++) {
+        reinst *in = &re->rprog[st->pcs[i]];
+        if (in->op == RE_CHAR) set[in->y >> 5] |= 1u << (in->y & 31);
+      }
+      ofstate[s] = numsets++;
+    }
+    at[p - from] = ofstate[s];
+    starts[p - from] = st->match || (p == 0 && (st->bolmatch || (len == 0 && d->empty)));
+    if (p == from) break;
+    unsigned char c = text[p - 1];
+    int t = d->next[s << 8 | c];
+    s = (t >= 0) ? t : reDfaNext(d, s, c);
+  }
+
+  int nslots = 2 * (re->ngroups + 1);
+  int sub[2 * (RE_MAX_GROUPS + 1)];
+  int *mark = calloc(re->proglen, sizeof(int));
+  int gen = 0, count = 0, lastend = -1;
+  for (int pos = from; pos <= len; ) {
+    if (!starts[pos - from]) {
+      pos++;
+      continue;
+    }
+    for (int i = 0; i < nslots; i++) sub[i] = -1;
+    int pc = 0;
+    for (int p = pos; ; p++) {
+      pc = reWalk(re, text, len, p, p < len ? &sets[at[p + 1 - from] * words] : NULL, pc, sub, mark, ++gen);
+      if (pc < 0 || re->prog[pc].op == RE_MATCH) break;
+      pc++;
+    }
+    if (pc < 0 || (sub[0] == sub[1] && sub[0] == lastend)) {
+      pos++;
+      continue;
+    }
+    count++;
+    if (!found(arg, sub) || !all) break;
+    lastend = sub[1];
+    pos = sub[1] > sub[0] ? sub[1] : sub[1] + 1;
+  }
+  free(mark);
+  free(at);
+  free(starts);
+  free(sets);
+  return count;
+}
+
+/*** search ***/
+
+/* Substring search for '*' and 'n'.  The vector versions are the "SIMD
+   friendly" memmem: compare the first and the last byte of the needle
+   against 16 or 32 positions at once and only memcmp where both match,
+   which for a word that's rare in the file skips nearly everything at the
+   cost of two loads and compares per block.  Nothing here needs the text to
+   be '\0' terminated.  Like scanNewlines the version is picked the first
+   time it's needed. */
+
+const char *findSubstrScalar(const char *hay, size_t n, const char *needle, size_t m) {
+  return memmem(hay, n, needle, m);
+}
+
+#ifdef KILO_SIMD_X86
+__attribute__((target("sse2")))
+const char *findSubstrSSE2(const char *hay, size_t n, const char *needle, size_t m) {
+  if (m < 2 || n < m) return memmem(hay, n, needle, m);
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    __m128i f = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)&hay[i]));
+    __m128i l = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)&hay[i + m - 1]));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(f, l));
+    while (mask) {
+      size_t at = i + __builtin_ctz(mask);
+      if (memcmp(&hay[at + 1], needle + 1, m - 2) == 0) return &hay[at];
+      mask &= mask - 1;
+    }
+  }
+  return memmem(&hay[i], n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+const char *findSubstrAVX2(const char *hay, size_t n, const char *needle, size_t m) {
+  if (m < 2 || n < m) return memmem(hay, n, needle, m);
+  __m256i first = _mm256_set1_epi8(needle[0]);
+  __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    __m256i f = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)&hay[i]));
+    __m256i l = _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)&hay[i + m - 1]));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(f, l));
+    while (mask) {
+      size_t at = i + __builtin_ctz(mask);
+      if (memcmp(&hay[at + 1], needle + 1, m - 2) == 0) return &hay[at];
+      mask &= mask - 1;
+    }
+  }
+  return memmem(&hay[i], n - i, needle, m);
+}
+#endif
+
+const char *(*findSubstr)(const char *hay, size_t n, const char *needle, size_t m) = NULL;
+
+void findSubstrInit(void) {
+  findSubstr = findSubstrScalar;
+#ifdef KILO_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) findSubstr = findSubstrAVX2;
+  else if (__builtin_cpu_supports("sse2")) findSubstr = findSubstrSSE2;
+#endif
+}
+
+#define SEARCH_SPAN (1024*1024) //most text handed to findSubstr at once - so a match close by is found quickly
+
+/* next and prev are both still the file as it was read with only line
+   endings between them - true for neighbouring rows nobody has touched */
+int editorRowsAdjoin(erow *prev, erow *next) {
+  const char *end = prev->piece + prev->size;
+  if (next->chars != NULL || next->piece < end || next->piece > end + 8) return 0;
+  if (next->piece < E.orig || next->piece >= E.orig + E.origlen) return 0;
+  for (const char *p = end; p < next->piece; p++)
+    if (*p != '\n' && *p != '\r') return 0;
+  return 1;
+}
+
+typedef struct match {
+  int fr, fc;
+} match;
+
+/* a search of rows [fr, end), starting at column fc of row fr, that finds
+   up to max matches in order - all of them if max is 0.  A job run on a
+   worker thread can't move the gap of a row so rows with their gap in the
+   middle are left in skipped for the main thread */
+typedef struct searchjob {
+  const char *needle;
+  int len;
+  regex *re; //needle is a pattern - NULL when it's just text
+  int fr, fc, end;
+  int max;
+  int threaded;
+  match *found;
+  int numfound, foundcap;
+  int *skipped;
+  int numskipped, skipcap;
+} searchjob;
+
+void searchJobAdd(searchjob *job, int fr, int fc) {
+  if (job->numfound == job->foundcap) {
+    job->foundcap = job->foundcap ? 2 * job->foundcap : 64;
+    job->found = realloc(job->found, sizeof(match) * job->foundcap);
+  }
+  job->found[job->numfound++] = (match){fr, fc};
+}
+
+typedef struct regexrow {
+  searchjob *job;
+  int fr;
+} regexrow;
+
+int searchJobRegexFound(void *arg, int fc) {
+  regexrow *r = arg;
+  searchJobAdd(r->job, r->fr, fc);
+  return r->job->numfound != r->job->max;
+}
+
+/* Rows that are untouched lines of the file are searched a span of them at
+   a time straight out of E.orig instead of a row at a time - a match can't
+   take in the line endings between them unless the needle has '\n' or '\r'
+   in it, and then every row is searched on its own.  For a pattern it's
+   the literal its matches start with that's looked for, and the rest of
+   the row from where that turns up goes through the DFA - or every row
+   does if there's no such literal */
+void editorSearchScan(searchjob *job, redfa *dfa) {
+  const char *needle = dfa ? job->re->prefix : job->needle;
+  int len = dfa ? job->re->prefixlen : job->len;
+  if (len == 0 && dfa == NULL) return;
+  int spans = E.piecetable && len && memchr(needle, '\n', len) == NULL && memchr(needle, '\r', len) == NULL;
+  int fr = job->fr, fc = job->fc;
+  int off;
+  int c = fenwickFind(E.chunkrows, E.numchunks, fr, &off);
+  while (fr < job->end) {
+    erow *row = &E.chunks[c]->rows[off];
+    int n = 1; //rows in the span
+    if (job->threaded && row->chars != NULL && row->gaplen && row->gap < row->size) {
+      if (job->numskipped == job->skipcap) {
+        job->skipcap = job->skipcap ? 2 * job->skipcap : 16;
+        job->skipped = realloc(job->skipped, sizeof(int) * job->skipcap);
+      }
+      job->skipped[job->numskipped++] = fr;
+    } else {
+      const char *text = job->threaded ? (row->chars ? row->chars : row->piece) : editorRowText(row);
+      const char *from = text + ((fc < row->size) ? fc : row->size);
+      const char *stop = text + row->size;
+
+      if (len == 0) {
+        regexrow r = {job, fr};
+        if (!reStarts(dfa, text, row->size, from - text, searchJobRegexFound, &r)) return;
+      } else {
+        if (spans && row->chars == NULL && row->piece >= E.orig && row->piece < E.orig + E.origlen) {
+          int c2 = c, off2 = off;
+          erow *prev = row;
+          while (fr + n < job->end && stop - from < SEARCH_SPAN) {
+            if (++off2 == E.chunks[c2]->numrows) {
+              c2++;
+              off2 = 0;
+            }
+            erow *next = &E.chunks[c2]->rows[off2];
+            if (!editorRowsAdjoin(prev, next)) break;
+            stop = next->piece + next->size;
+            prev = next;
+            n++;
+          }
+        }
+
+        // z only goes forward so the row it's in is found by walking the span
+        int zfr = fr, zc = c, zoff = off;
+        const char *z;
+        while ((z = findSubstr(from, stop - from, needle, len)) != NULL) {
+          while (z >= text + row->size) {
+            zfr++;
+            if (++zoff == E.chunks[zc]->numrows) {
+              zc++;
+              zoff = 0;
+            }
+            row = &E.chunks[zc]->rows[zoff];
+            text = row->piece;
+          }
+          if (dfa) {
+            regexrow r = {job, zfr};
+            if (!reStarts(dfa, text, row->size, z - text, searchJobRegexFound, &r)) return;
+            from = text + row->size; //on to the next row
+            continue;
+          }
+          searchJobAdd(job, zfr, z - text);
+          if (job->numfound == job->max) return;
+          from = z + 1;
+        }
+      }
+    }
+
+    fr += n;
+    off += n;
+    while (c < E.numchunks && off >= E.chunks[c]->numrows) {
+      off -= E.chunks[c]->numrows;
+      c++;
+    }
+    fc = 0;
+  }
+}
+
+void editorSearchJob(searchjob *job) {
+  if (findSubstr == NULL) findSubstrInit();
+  // each job has its own DFA - it's built as it's used so threads can't share one
+  redfa *dfa = (job->re && !job->re->literal) ? reDfaNew(job->re) : NULL;
+  editorSearchScan(job, dfa);
+  reDfaFree(dfa);
+}
+
+/* looks for needle (a pattern if re isn't NULL) in rows [fr, end),
+   starting at column fc of row fr, and returns 1 with the row and column of
+   the match in *mfr and *mfc */
+int editorSearchRows(const char *needle, int len, regex *re, int fr, int fc, int end, int *mfr, int *mfc) {
+  searchjob job = {needle, len, re, fr, fc, end, 1, 0, NULL, 0, 0, NULL, 0, 0};
+  editorSearchJob(&job);
+  if (job.numfound) {
+    *mfr = job.found[0].fr;
+    *mfc = job.found[0].fc;
+  }
+  free(job.found);
+  return job.numfound;
+}
+
+// the same going backwards - the last match in rows [end, fr] that starts before column fc of row fr
+int editorSearchRowsBack(const char *needle, int len, regex *re, int fr, int fc, int end, int *mfr, int *mfc) {
+  for (; fr >= end; fr--, fc = INT_MAX) {
+    searchjob job = {needle, len, re, fr, 0, fr + 1, 0, 0, NULL, 0, 0, NULL, 0, 0};
+    editorSearchJob(&job);
+    int i = job.numfound - 1;
+    while (i >= 0 && job.found[i].fc >= fc) i--;
+    if (i >= 0) {
+      *mfr = fr;
+      *mfc = job.found[i].fc;
+    }
+    free(job.found);
+    if (i >= 0) return 1;
+  }
+  return 0;
+}
+
+/* For big files one 'n' could walk most of the file, so the first '*' or
+   'n' for a word finds every match at once, with the rows split between
+   threads, into a sorted index that 'n' and 'N' then binary search.  Edits
+   don't throw the index away: editorJournalAdd tells it about every change
+   and before it's used again the rows after inserted or deleted rows are
+   renumbered and just the changed rows are searched again.  A word with
+   more than MATCH_MAX matches isn't indexed - there's one every few bytes
+   anyway so the plain search finds the next one straight away. */
+
+#define MATCH_MAX (16*1024*1024)
+#define MATCH_PENDING 64 //changes kept track of before the index is made again instead
+#define MAX_SEARCH_THREADS 16
+
+struct {
+  char *needle; //the word the index is for - NULL if there's no index
+  int len;
+  int isregex; //needle is a pattern from '/'
+  regex *re; //compiled - NULL if it's a pattern with nothing special in it
+  match *m; //every match in the file in order
+  int n;
+  int pendtype[MATCH_PENDING]; //changes since the index was brought up to date
+  int pendrow[MATCH_PENDING];
+  int numpending;
+  int toomany; //the word has more than MATCH_MAX matches
+} matches;
+
+void editorMatchesFree(void) {
+  free(matches.needle);
+  free(matches.m);
+  reFree(matches.re);
+  matches.needle = NULL;
+  matches.m = NULL;
+  matches.re = NULL;
+  matches.n = matches.numpending = matches.toomany = 0;
+}
+
+// called by editorJournalAdd for every change to the text
+void editorMatchesChanged(int type, int fr) {
+  if (matches.needle == NULL || matches.toomany) return;
+  if (matches.numpending == MATCH_PENDING) {
+    editorMatchesFree(); //quicker to search everything again
+    return;
+  }
+  matches.pendtype[matches.numpending] = type;
+  matches.pendrow[matches.numpending++] = fr;
+}
+
+// index of the first match at or after row fr, column fc
+int editorMatchesFind(int fr, int fc) {
+  int lo = 0, hi = matches.n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    match *m = &matches.m[mid];
+    if (m->fr < fr || (m->fr == fr && m->fc < fc)) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// the matches (already in order) replace those in [from, to) of the index
+void editorMatchesSplice(int from, int to, match *m, int n) {
+  int newn = matches.n - (to - from) + n;
+  if (n > to - from) matches.m = realloc(matches.m, sizeof(match) * (newn ? newn : 1));
+  memmove(&matches.m[from + n], &matches.m[to], sizeof(match) * (matches.n - to));
+  if (n) memcpy(&matches.m[from], m, sizeof(match) * n);
+  matches.n = newn;
+}
+
+void *editorSearchWorker(void *arg) {
+  editorSearchJob(arg);
+  return NULL;
+}
+
+// makes the index of needle from scratch
+void editorMatchesBuild(const char *needle, int len, int isregex) {
+  if (findSubstr == NULL) findSubstrInit(); //before the workers all try to
+  editorMatchesFree();
+  matches.needle = malloc(len);
+  memcpy(matches.needle, needle, len);
+  matches.len = len;
+  matches.isregex = isregex;
+  if (isregex) {
+    const char *err;
+    matches.re = reCompile(needle, len, &err);
+    if (matches.re == NULL) return; //no matches - '/' doesn't let a bad pattern get this far
+    if (matches.re->literal) {
+      reFree(matches.re);
+      matches.re = NULL;
+    }
+  }
+
+  // rows are split between threads by the bytes in their chunks
+  long long total = 0;
+  for (int c = 0; c < E.numchunks; c++) total += E.chunks[c]->bytes;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int numjobs = (total < PARALLEL_MIN || cpus < 2) ? 1 : (cpus > MAX_SEARCH_THREADS ? MAX_SEARCH_THREADS : cpus);
+  searchjob jobs[MAX_SEARCH_THREADS];
+  pthread_t threads[MAX_SEARCH_THREADS];
+  int started[MAX_SEARCH_THREADS];
+  int fr = 0, c = 0;
+  long long bytes = 0;
+  for (int j = 0; j < numjobs; j++) {
+    int start = fr;
+    long long want = total * (j + 1) / numjobs;
+    while (c < E.numchunks && (bytes < want || j == numjobs - 1)) {
+      bytes += E.chunks[c]->bytes;
+      fr += E.chunks[c++]->numrows;
+    }
+    jobs[j] = (searchjob){needle, len, matches.re, start, 0, fr, MATCH_MAX + 1, numjobs > 1, NULL, 0, 0, NULL, 0, 0};
+  }
+  for (int j = 1; j < numjobs; j++)
+    started[j] = pthread_create(&threads[j], NULL, editorSearchWorker, &jobs[j]) == 0;
+  editorSearchJob(&jobs[0]);
+  for (int j = 1; j < numjobs; j++) {
+    if (started[j]) pthread_join(threads[j], NULL);
+    else editorSearchJob(&jobs[j]);
+  }
+
+  long long n = 0;
+  for (int j = 0; j < numjobs; j++) n += jobs[j].numfound;
+  if (n > MATCH_MAX) matches.toomany = 1;
+  else {
+    matches.m = malloc(sizeof(match) * (n ? n : 1));
+    for (int j = 0; j < numjobs; j++) {
+      if (jobs[j].numfound) memcpy(&matches.m[matches.n], jobs[j].found, sizeof(match) * jobs[j].numfound);
+      matches.n += jobs[j].numfound;
+    }
+  }
+  // the rows the workers left are searched now that they're done
+  for (int j = 0; j < numjobs; j++) {
+    for (int i = 0; i < jobs[j].numskipped && !matches.toomany; i++) {
+      int sfr = jobs[j].skipped[i];
+      searchjob job = {needle, len, matches.re, sfr, 0, sfr + 1, 0, 0, NULL, 0, 0, NULL, 0, 0};
+      editorSearchJob(&job);
+      int at = editorMatchesFind(sfr, 0);
+      editorMatchesSplice(at, at, job.found, job.numfound);
+      if (matches.n > MATCH_MAX) matches.toomany = 1;
+      free(job.found);
     }
+    free(jobs[j].found);
+    free(jobs[j].skipped);
+  }
+  if (matches.toomany) {
+    free(matches.m);
+    matches.m = NULL;
+    matches.n = 0;
+  }
+}
 
-  for ( int j=0; j < i; j++ ) editorInsertChar(' ');
-  E.cx = i;
+// brings the index up to date with the changes since it was made
+void editorMatchesCatchUp(void) {
+  int dirty[MATCH_PENDING]; //rows to search again
+  int numdirty = 0;
+  for (int p = 0; p < matches.numpending; p++) {
+    int type = matches.pendtype[p], fr = matches.pendrow[p];
+    int from = editorMatchesFind(fr, 0);
+    int to = editorMatchesFind(fr + 1, 0);
+    int shift = 0;
+    if (type == U_ROW_INS) {
+      to = from;
+      shift = 1;
+    }
+    if (type == U_ROW_DEL) shift = -1;
+    editorMatchesSplice(from, to, NULL, 0);
+    for (int i = from; shift && i < matches.n; i++) matches.m[i].fr += shift;
+
+    int keep = 0, listed = 0;
+    for (int d = 0; d < numdirty; d++) {
+      if (dirty[d] == fr && type == U_ROW_DEL) continue;
+      if (dirty[d] > fr || (dirty[d] == fr && shift > 0)) dirty[d] += shift;
+      if (dirty[d] == fr) listed = 1;
+      dirty[keep++] = dirty[d];
+    }
+    numdirty = keep;
+    if (type != U_ROW_DEL && !listed) dirty[numdirty++] = fr;
+  }
+  matches.numpending = 0;
+
+  for (int d = 0; d < numdirty; d++) {
+    if (dirty[d] >= E.filerows) continue;
+    searchjob job = {matches.needle, matches.len, matches.re, dirty[d], 0, dirty[d] + 1, 0, 0, NULL, 0, 0, NULL, 0, 0};
+    editorSearchJob(&job);
+    int at = editorMatchesFind(dirty[d], 0);
+    editorMatchesSplice(at, at, job.found, job.numfound);
+    free(job.found);
   }
 }
 
-void editorDelChar(void) {
-  erow *row = &E.row[editorGetFileRow()];
+/* finds the next match of needle (a pattern if isregex is set) after row fr, column fc (or the one
+   before it when back is set), going round the end of the file - returns 0
+   if there isn't one */
+int editorSearchNext(const char *needle, int len, int isregex, int fr, int fc, int back, int *mfr, int *mfc) {
+  if (matches.needle == NULL || matches.len != len || matches.isregex != isregex || memcmp(matches.needle, needle, len) != 0)
+    editorMatchesBuild(needle, len, isregex);
+  else if (matches.numpending) editorMatchesCatchUp();
+
+  regex *re = matches.re;
+  if (matches.toomany) {
+    if (back)
+      return editorSearchRowsBack(needle, len, re, fr, fc, 0, mfr, mfc) ||
+             editorSearchRowsBack(needle, len, re, E.filerows - 1, INT_MAX, fr, mfr, mfc);
+    return editorSearchRows(needle, len, re, fr, fc + 1, E.filerows, mfr, mfc) ||
+           editorSearchRows(needle, len, re, 0, 0, fr + 1, mfr, mfc);
+  }
 
-  /* row size = 1 means there is 1 char; size 0 means 0 chars */
-  /* Note that row->size does not count the terminating '\0' char*/
-  // note below order important because row->size undefined if E.filerows = 0 because E.row is NULL
-  if (E.filerows == 0 || row->size == 0 ) return; 
+  if (matches.n == 0) return 0;
+  int i = back ? editorMatchesFind(fr, fc) - 1 : editorMatchesFind(fr, fc + 1);
+  if (i < 0) i = matches.n - 1;
+  if (i == matches.n) i = 0;
+  *mfr = matches.m[i].fr;
+  *mfc = matches.m[i].fc;
+  return 1;
+}
 
-  memmove(&row->chars[editorGetFileCol()], &row->chars[editorGetFileCol() + 1], row->size - editorGetFileCol());
-  row->size--;
+/* '/' searches as the pattern is typed.  The scan starts just after the
+   cursor and goes round the end of the file, a slice of rows at a time from
+   editorReadKey while no key is waiting, so a keystroke is never held up by
+   a scan of a big file - it cuts the scan short and the next one carries on
+   from there.  When the pattern only grew, the matches of the old one that
+   are still matches are kept (every match of the longer pattern starts
+   where the shorter one matched) and only the rows not scanned yet are
+   searched - as long as the patterns are plain text, since with a pattern
+   like a|b more can match as it grows.  There can be millions of old
+   matches, so they're looked at again a slice at a time between keys too,
+   before the scan carries on.  The cursor goes to the first match after
+   where it was as soon as it's found. */
+
+#define SEARCH_SLICE (4*1024*1024) //bytes of rows scanned between looks at the keyboard
+#define PRUNE_SLICE (64*1024) //old matches looked at again between looks at the keyboard
+
+struct {
+  char pattern[sizeof(search_string)];
+  int len;
+  regex *re; //pattern compiled - NULL if it's plain text or isn't a valid pattern
+  const char *err; //why it isn't valid
+  int fr, fc; //where the cursor was when '/' was pressed
+  int cx, cy, rowoff; //to put it back if the search is given up
+  match *found; //matches of pattern so far, in the order they're found
+  int numfound, foundcap;
+  long long count; //can be more than numfound - see overflow
+  int overflow; //more than MATCH_MAX matches - only the first MATCH_MAX are kept
+  int next; //next row to scan
+  int wrapped; //the scan has gone round to the top of the file
+  int complete;
+  int shown; //the cursor has been put on the first match
+  // after the pattern grew: found[checked, numfound) haven't been looked at again yet and the ones kept so far are found[0, kept)
+  int pruning;
+  int checked, kept;
+} isearch;
+
+// whether m is at or before where the search started - so it was found after the scan wrapped
+int editorSearchWrapped(match *m) {
+  return m->fr < isearch.fr || (m->fr == isearch.fr && m->fc <= isearch.fc);
+}
 
-  if (E.filerows == 1 && row->size == 0) {
-    E.filerows = 0;
-    free(E.row);
-    //editorFreeRow(&E.row[fr]);
-    E.row = NULL;
+void editorSearchFound(int fr, int fc) {
+  isearch.count++;
+  if (isearch.overflow) return;
+  if (isearch.numfound == MATCH_MAX) {
+    isearch.overflow = 1;
+    return;
   }
-  else if (E.cx == row->size && E.cx) E.cx = row->size - 1;  // not sure what to do about this
-
-  E.dirty++;
+  if (isearch.numfound == isearch.foundcap) {
+    isearch.foundcap = isearch.foundcap ? 2 * isearch.foundcap : 64;
+    isearch.found = realloc(isearch.found, sizeof(match) * isearch.foundcap);
+  }
+  isearch.found[isearch.numfound++] = (match){fr, fc};
 }
 
-void editorBackspace(void) {
-  if (E.cx == 0 && E.cy == 0) return;
-  int fc = editorGetFileCol();
-  int fr = editorGetFileRow();
-  erow *row = &E.row[fr];
+// starts the scan over
+void editorSearchRestart(void) {
+  isearch.numfound = 0;
+  isearch.count = 0;
+  isearch.overflow = 0;
+  isearch.next = isearch.fr;
+  isearch.wrapped = 0;
+  isearch.complete = (isearch.len == 0 || E.filerows == 0 || isearch.err);
+  isearch.shown = 0;
+  isearch.pruning = 0;
+}
 
-  if (E.cx > 0) {
-    //memmove(dest, source, number of bytes to move?)
-    memmove(&row->chars[fc - 1], &row->chars[fc], row->size - fc + 1);
-    row->size--;
-    if (E.cx == 1 && row->size/E.screencols && fc > row->size) E.continuation = 1; //right now only backspace in multi-line
-    E.cx--;
-  } else { //else E.cx == 0 and could be multiline
-    if (fc > 0) { //this means it's a multiline row and we're not at the top
-      memmove(&row->chars[fc - 1], &row->chars[fc], row->size - fc + 1);
-      row->size--;
-      E.cx = E.screencols - 1;
-      E.cy--;
-      E.continuation = 0;
-    } else {// this means we're at fc == 0 so we're in the first filecolumn
-      E.cx = (E.row[fr - 1].size/E.screencols) ? E.screencols : E.row[fr - 1].size ;
-      //if (E.cx < 0) E.cx = 0; //don't think this guard is necessary but we'll see
-      editorRowAppendString(&E.row[fr - 1], row->chars, row->size); //only use of this function
-      editorFreeRow(&E.row[fr]);
-      memmove(&E.row[fr], &E.row[fr + 1], sizeof(erow) * (E.filerows - fr - 1));
-      E.filerows--;
-      E.cy--;
+// scans the next slice of rows
+void editorSearchSlice(void) {
+  // rows up to where the slice's bytes run out, or to the end of this lap of the file
+  int stop = isearch.wrapped ? isearch.fr + 1 : E.filerows;
+  int off;
+  int c = fenwickFind(E.chunkrows, E.numchunks, isearch.next, &off);
+  int end = isearch.next;
+  long long bytes = 0;
+  while (end < stop && bytes < SEARCH_SLICE) {
+    end += E.chunks[c]->numrows - off;
+    bytes += E.chunks[c++]->bytes;
+    off = 0;
+  }
+  if (end > stop) end = stop;
+
+  int fc = (!isearch.wrapped && isearch.next == isearch.fr) ? isearch.fc + 1 : 0;
+  searchjob job = {isearch.pattern, isearch.len, isearch.re, isearch.next, fc, end, 0, 0, NULL, 0, 0, NULL, 0, 0};
+  editorSearchJob(&job);
+  for (int i = 0; i < job.numfound; i++)
+    if (!isearch.wrapped || editorSearchWrapped(&job.found[i]))
+      editorSearchFound(job.found[i].fr, job.found[i].fc);
+  free(job.found);
+
+  isearch.next = end;
+  if (end == stop) {
+    if (isearch.wrapped) isearch.complete = 1;
+    else {
+      isearch.wrapped = 1;
+      isearch.next = 0;
     }
   }
-  E.dirty++;
 }
 
-/*** file i/o ***/
+void editorSearchShow(void) {
+  if (isearch.numfound) {
+    editorGotoMatch(isearch.found[0].fr, isearch.found[0].fc);
+    isearch.shown = 1;
+  } else {
+    E.cx = isearch.cx;
+    E.cy = isearch.cy;
+    E.rowoff = isearch.rowoff;
+  }
+}
 
-char *editorRowsToString(int *buflen) {
-  int totlen = 0;
-  int j;
-  for (j = 0; j < E.filerows; j++)
-    totlen += E.row[j].size + 1;
-  *buflen = totlen;
-
-  char *buf = malloc(totlen);
-  char *p = buf;
-  for (j = 0; j < E.filerows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
+// looks at the next slice of the old matches after the pattern grew and keeps the ones that still match
+void editorSearchPrune(void) {
+  int end = isearch.checked + PRUNE_SLICE;
+  if (end > isearch.numfound) end = isearch.numfound;
+  char *buf = malloc(isearch.len);
+  for (; isearch.checked < end; isearch.checked++) {
+    match m = isearch.found[isearch.checked];
+    erow *row = editorRow(m.fr);
+    if (row->size - m.fc < isearch.len) continue;
+    editorRowRead(row, m.fc, isearch.len, buf);
+    if (memcmp(buf, isearch.pattern, isearch.len) == 0) isearch.found[isearch.kept++] = m;
+  }
+  free(buf);
+  if (isearch.checked == isearch.numfound) {
+    isearch.numfound = isearch.kept;
+    isearch.count = isearch.kept;
+    isearch.pruning = 0;
+    if (isearch.numfound == 0) editorSearchShow(); //none of them - back where it started
   }
-  return buf;
 }
 
-void editorOpen(char *filename) {
-  free(E.filename);
-  E.filename = strdup(filename);
+// called from editorReadKey - scans until a key is pressed or the scan is done
+void editorSearchIdle(void) {
+  if (E.mode != 6 || (isearch.complete && !isearch.pruning)) return;
+  while (!isearch.complete || isearch.pruning) {
+    fd_set fds;
+    struct timeval tv = {0, 0};
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0) return;
+    if (isearch.pruning) editorSearchPrune();
+    else editorSearchSlice();
+    if (!isearch.shown && (isearch.pruning ? isearch.kept : isearch.numfound)) {
+      editorSearchShow();
+      editorRefreshScreen();
+    }
+  }
+  editorRefreshScreen(); //for the count
+}
 
-  FILE *fp = fopen(filename, "r");
-  if (!fp) die("fopen");
+// what the message bar shows while the pattern is typed
+void editorSearchMessage(void) {
+  if (isearch.err) editorSetMessage("/%s  (%s)", isearch.pattern, isearch.err);
+  else if (!isearch.complete || isearch.pruning || isearch.len == 0) editorSetMessage("/%s", isearch.pattern);
+  else if (isearch.count == 0) editorSetMessage("/%s  (not found)", isearch.pattern);
+  else editorSetMessage("/%s  (%lld match%s)", isearch.pattern, isearch.count, isearch.count == 1 ? "" : "es");
+}
 
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                           line[linelen - 1] == '\r'))
-      linelen--;
-    editorInsertRow(E.filerows, line, linelen);
-  }
-  free(line);
-  fclose(fp);
-  E.dirty = 0;
+// '/' - starts the prompt
+void editorSearchPrompt(void) {
+  editorIndexAll();
+  isearch.fr = E.filerows ? editorGetFileRow() : 0;
+  isearch.fc = E.filerows ? editorGetFileCol() : 0;
+  isearch.cx = E.cx;
+  isearch.cy = E.cy;
+  isearch.rowoff = E.rowoff;
+  isearch.len = 0;
+  isearch.pattern[0] = '\0';
+  reFree(isearch.re);
+  isearch.re = NULL;
+  isearch.err = NULL;
+  editorSearchRestart();
+  E.mode = 6;
 }
 
-void editorSave(void) {
-  if (E.filename == NULL) return;
-  int len;
-  char *buf = editorRowsToString(&len);
+// the keys typed at the '/' prompt
+void editorSearchPromptKey(int c) {
+  if (c == '\x1b' || ((c == BACKSPACE || c == DEL_KEY || c == CTRL_KEY('h')) && isearch.len == 0)) {
+    isearch.numfound = 0;
+    editorSearchShow(); //back where it started
+    E.mode = 0;
+    editorSetMessage("");
+    return;
+  }
 
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        E.dirty = 0;
-        editorSetMessage("%d bytes written to disk", len);
-        return;
-      }
+  if (c == '\r') {
+    E.mode = 0;
+    if (isearch.len == 0) return;
+    if (isearch.err) {
+      editorSetMessage("%s: %s", isearch.err, isearch.pattern);
+      return;
     }
-    close(fd);
+    memcpy(search_string, isearch.pattern, isearch.len + 1);
+    search_regex = 1;
+    if (isearch.pruning) {
+      while (isearch.pruning) editorSearchPrune();
+      editorSearchShow();
+    }
+    if (isearch.complete && !isearch.overflow) {
+      // 'n' and 'N' get the matches as they are - in file order, which starts where the scan wrapped
+      int wrap = 0;
+      while (wrap < isearch.numfound && !editorSearchWrapped(&isearch.found[wrap])) wrap++;
+      editorMatchesFree();
+      matches.needle = malloc(isearch.len);
+      memcpy(matches.needle, isearch.pattern, isearch.len);
+      matches.len = isearch.len;
+      matches.isregex = 1;
+      matches.re = isearch.re;
+      isearch.re = NULL;
+      matches.n = isearch.numfound;
+      matches.m = malloc(sizeof(match) * (matches.n ? matches.n : 1));
+      memcpy(matches.m, &isearch.found[wrap], sizeof(match) * (matches.n - wrap));
+      memcpy(&matches.m[matches.n - wrap], isearch.found, sizeof(match) * wrap);
+    }
+    if (isearch.numfound == 0 && isearch.complete) editorSetMessage("Pattern not found: %s", isearch.pattern);
+    if (isearch.numfound == 0 && !isearch.complete) editorFindNextWord(); //Enter before the first match turned up
+    return;
   }
 
-  free(buf);
-  editorSetMessage("Can't save! I/O error: %s", strerror(errno));
+  int plain = (isearch.re == NULL && isearch.err == NULL); //the pattern so far is just text
+  if (c == BACKSPACE || c == DEL_KEY || c == CTRL_KEY('h')) isearch.pattern[--isearch.len] = '\0';
+  else if (c >= 32 && c < 127 && isearch.len < (int)sizeof(isearch.pattern) - 1) {
+    isearch.pattern[isearch.len++] = c;
+    isearch.pattern[isearch.len] = '\0';
+  } else return;
+
+  reFree(isearch.re);
+  isearch.err = NULL;
+  isearch.re = reCompile(isearch.pattern, isearch.len, &isearch.err);
+  if (isearch.re && isearch.re->literal) {
+    reFree(isearch.re);
+    isearch.re = NULL;
+  }
+  if (c != BACKSPACE && c != DEL_KEY && c != CTRL_KEY('h')) {
+    if (isearch.overflow || isearch.len == 1 || !plain || isearch.re || isearch.err) editorSearchRestart();
+    else {
+      // the pattern grew - the old matches that still match are kept (editorSearchPrune) and the scan carries on from where it got to
+      if (isearch.pruning) { //the ones not looked at yet go after the ones kept
+        memmove(&isearch.found[isearch.kept], &isearch.found[isearch.checked], sizeof(match) * (isearch.numfound - isearch.checked));
+        isearch.numfound = isearch.kept + isearch.numfound - isearch.checked;
+      }
+      isearch.pruning = 1;
+      isearch.checked = isearch.kept = 0;
+      isearch.shown = 0;
+    }
+  } else editorSearchRestart();
+
+  if (!isearch.pruning) editorSearchShow(); //otherwise the cursor stays on the first old match until the first new one is known
 }
 
 /*** append buffer ***/
@@ -581,51 +3984,106 @@ void editorSave(void) {
 struct abuf {
   char *b;
   int len;
+  int cap; //bytes allocated for b - the buffers are reused so this only ever grows
 };
 
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 void abAppend(struct abuf *ab, const char *s, int len) {
 
   /*
      initally abuf consists of *b = NULL pointer and int len = 0
      abuf.b holds the pointer to the memory that holds the string
-     the below creates a new memory pointer that reallocates
-     memory to something 
+     the buffer doubles when it runs out of room so once the buffers
+     used for drawing have grown to the size of a frame drawing
+     doesn't realloc at all
   */
 
-  /*realloc's first argument is the current pointer to memory and the second argumment is the size_t needed*/
-  char *new = realloc(ab->b, ab->len + len); 
+  if (ab->len + len > ab->cap) {
+    int cap = ab->cap ? ab->cap : 256;
+    while (cap < ab->len + len) cap *= 2;
 
-  if (new == NULL) return;
-  /*new is the new pointer to the string
-    new[len] is a value and memcpy needs a pointer
-    to the location in the string where s is being copied*/
+    /*realloc's first argument is the current pointer to memory and the second argumment is the size_t needed*/
+    char *new = realloc(ab->b, cap); 
+    if (new == NULL) return;
+    ab->b = new;
+    ab->cap = cap;
+  }
 
   //copy s on to the end of whatever string was there
-  memcpy(&new[ab->len], s, len); 
-
-  ab->b = new;
+  memcpy(&ab->b[ab->len], s, len); 
   ab->len += len;
 }
 
+// appends [start, start + len) of a row without closing the row's gap
+void abAppendRow(struct abuf *ab, erow *row, int start, int len) {
+  if (len <= 0) return;
+  if (row->chars == NULL) {
+    abAppend(ab, &row->piece[start], len);
+    return;
+  }
+  if (start < row->gap) {
+    int n = (start + len <= row->gap) ? len : row->gap - start;
+    abAppend(ab, &row->chars[start], n);
+    start += n;
+    len -= n;
+  }
+  if (len > 0) abAppend(ab, &row->chars[start + row->gaplen], len);
+}
+
 void abFree(struct abuf *ab) {
   free(ab->b);
 }
 
+/*** screen ***/
+
+/* screen[y] holds the bytes that last drew screen line y (the text rows then
+   the status bar and message bar).  Each frame every line is drawn into
+   drawline and editorDrawLine only sends it to the terminal, behind a cursor
+   move, if it differs from what is already there - so typing in a line
+   that doesn't wrap sends that line and the bars, not the whole screen */
+struct abuf *screen = NULL;
+int screenlines = 0;
+struct abuf drawline = ABUF_INIT; //the screen line being drawn
+
+void editorDrawLine(struct abuf *ab, int y, struct abuf *line) {
+  if (y >= screenlines) {
+    screen = realloc(screen, sizeof(struct abuf) * (y + 1));
+    for (; screenlines <= y; screenlines++) {
+      screen[screenlines].b = NULL;
+      screen[screenlines].len = -1; //never matches so the line gets drawn
+      screen[screenlines].cap = 0;
+    }
+  }
+
+  struct abuf *old = &screen[y];
+  if (old->len != line->len || memcmp(old->b, line->b, line->len) != 0) {
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    abAppend(ab, buf, len);
+    abAppend(ab, line->b, line->len);
+    // the line just drawn becomes the shadow and the old shadow's memory is reused for the next line
+    struct abuf tmp = *old;
+    *old = *line;
+    *line = tmp;
+  }
+  line->len = 0;
+}
+
 /*** output ***/
 /* cursor can be move negative or beyond screen lines and also in wrong x and
 this function deals with that */
 void editorScroll(void) {
-  if (!E.row) return;
-  int lines =  E.row[editorGetFileRow()].size/E.screencols + 1;
-  if (E.row[editorGetFileRow()].size%E.screencols == 0) lines--;
+  editorIndexTo(editorGetFileRowByLine(E.screenrows) + E.screenrows);
+  if (E.filerows == 0) return;
+  int lines =  editorRow(editorGetFileRow())->size/E.screencols + 1;
+  if (editorRow(editorGetFileRow())->size%E.screencols == 0) lines--;
   //if (E.cy >= E.screenrows) {
   if (E.cy + lines - 1 >= E.screenrows) {
-    int first_row_lines = E.row[editorGetFileRowByLine(0)].size/E.screencols + 1; //****
-    if (E.row[editorGetFileRowByLine(0)].size && E.row[editorGetFileRowByLine(0)].size%E.screencols == 0) first_row_lines--;
-    int lines =  E.row[editorGetFileRow()].size/E.screencols + 1;
-    if (E.row[editorGetFileRow()].size%E.screencols == 0) lines--;
+    int first_row_lines = editorRow(editorGetFileRowByLine(0))->size/E.screencols + 1; //****
+    if (editorRow(editorGetFileRowByLine(0))->size && editorRow(editorGetFileRowByLine(0))->size%E.screencols == 0) first_row_lines--;
+    int lines =  editorRow(editorGetFileRow())->size/E.screencols + 1;
+    if (editorRow(editorGetFileRow())->size%E.screencols == 0) lines--;
     int delta = E.cy + lines - E.screenrows; //////
     delta = (delta > first_row_lines) ? delta : first_row_lines; //
     E.rowoff += delta;
@@ -655,6 +4113,7 @@ void editorScroll(void) {
 void editorDrawRows(struct abuf *ab) {
   int y = 0;
   int len, n;
+  struct abuf *line = &drawline;
   //int filerow = 0;
   int filerow = editorGetFileRowByLine(0); //thought is find the first row given E.rowoff
 
@@ -669,21 +4128,22 @@ void editorDrawRows(struct abuf *ab) {
       //drawing '~' below: first escape is red and second erases rest of line
       //may not be worth this if else to not draw ~ in first row
       //and probably there is a better way to do it
-      if (y) abAppend(ab, "\x1b[31m~~\x1b[K", 10); 
-      else abAppend(ab, "\x1b[K", 3); 
-      abAppend(ab, "\r\n", 2);
+      if (y) abAppend(line, "\x1b[31m~~\x1b[K", 10); 
+      else abAppend(line, "\x1b[K", 3); 
+      abAppend(line, "\x1b[0m", 4); //slz return background to normal
+      editorDrawLine(ab, y, line);
       y++;
 
     } else {
 
-      int lines = E.row[filerow].size/E.screencols;
-      if (E.row[filerow].size%E.screencols) lines++;
+      int lines = editorRow(filerow)->size/E.screencols;
+      if (editorRow(filerow)->size%E.screencols) lines++;
       if (lines == 0) lines = 1;
       if ((y + lines) > E.screenrows) {
           for (n=0; n < (E.screenrows - y);n++) {
-            abAppend(ab, "@", 2);
-            abAppend(ab, "\x1b[K", 3); 
-            abAppend(ab, "\r\n", 2); ///////////////////////////////////////////
+            abAppend(line, "@", 2);
+            abAppend(line, "\x1b[K", 3); 
+            editorDrawLine(ab, y + n, line); ///////////////////////////////////////////
           }
       break;
       }      
@@ -691,46 +4151,45 @@ void editorDrawRows(struct abuf *ab) {
       for (n=0; n<lines;n++) {
         y++;
         int start = n*E.screencols;
-        if ((E.row[filerow].size - n*E.screencols) > E.screencols) len = E.screencols;
-        else len = E.row[filerow].size - n*E.screencols;
+        if ((editorRow(filerow)->size - n*E.screencols) > E.screencols) len = E.screencols;
+        else len = editorRow(filerow)->size - n*E.screencols;
 
         if (E.mode == 3 && filerow >= E.highlight[0] && filerow <= E.highlight[1]) {
-            abAppend(ab, "\x1b[48;5;242m", 11);
-            abAppend(ab, &E.row[filerow].chars[start], len);
-            abAppend(ab, "\x1b[0m", 4); //slz return background to normal
+            abAppend(line, "\x1b[48;5;242m", 11);
+            abAppendRow(line, editorRow(filerow), start, len);
+            abAppend(line, "\x1b[0m", 4); //slz return background to normal
         
         } else if (E.mode == 4 && filerow == editorGetFileRow()) {
             //if ((E.highlight[0] > start) && (E.highlight[0] < start + len)) {
             if ((E.highlight[0] >= start) && (E.highlight[0] < start + len)) {
-            abAppend(ab, &E.row[filerow].chars[start], E.highlight[0] - start);
-            abAppend(ab, "\x1b[48;5;242m", 11);
-            abAppend(ab, &E.row[filerow].chars[E.highlight[0]], E.highlight[1]
+            abAppendRow(line, editorRow(filerow), start, E.highlight[0] - start);
+            abAppend(line, "\x1b[48;5;242m", 11);
+            abAppendRow(line, editorRow(filerow), E.highlight[0], E.highlight[1]
                                                 - E.highlight[0]);
-            abAppend(ab, "\x1b[0m", 4); //slz return background to normal
-            abAppend(ab, &E.row[filerow].chars[E.highlight[1]], start + len - E.highlight[1]);
-            } else abAppend(ab, &E.row[filerow].chars[start], len);
+            abAppend(line, "\x1b[0m", 4); //slz return background to normal
+            abAppendRow(line, editorRow(filerow), E.highlight[1], start + len - E.highlight[1]);
+            } else abAppendRow(line, editorRow(filerow), start, len);
 
         
-        } else abAppend(ab, &E.row[filerow].chars[start], len);
+        } else abAppendRow(line, editorRow(filerow), start, len);
     
       //"\x1b[K" erases the part of the line to the right of the cursor in case the
       // new line i shorter than the old
 
-      abAppend(ab, "\x1b[K", 3); 
-      abAppend(ab, "\r\n", 2); ///////////////////////////////////////////
-      abAppend(ab, "\x1b[0m", 4); //slz return background to normal
+      abAppend(line, "\x1b[K", 3); 
+      abAppend(line, "\x1b[0m", 4); //slz return background to normal
+      editorDrawLine(ab, y - 1, line); ///////////////////////////////////////////
       }
 
       filerow++;
     }
-    //abAppend(ab, "\r\n", 2);
-   abAppend(ab, "\x1b[0m", 4); //slz return background to normal
   }
 }
 
 //status bar has inverted colors
 void editorDrawStatusBar(struct abuf *ab) {
-  abAppend(ab, "\x1b[7m", 4); //switches to inverted colors
+  struct abuf *line = &drawline;
+  abAppend(line, "\x1b[7m", 4); //switches to inverted colors
   char status[80], rstatus[80];
   int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
     E.filename ? E.filename : "[No Name]", E.filerows,
@@ -738,22 +4197,22 @@ void editorDrawStatusBar(struct abuf *ab) {
   int rlen = snprintf(rstatus, sizeof(rstatus), "Status bar %d/%d",
     E.cy + 1, E.filerows);
   if (len > E.screencols) len = E.screencols;
-  abAppend(ab, status, len);
+  abAppend(line, status, len);
   
   /* add spaces until you just have enough room
      left to print the status message  */
 
   while (len < E.screencols) {
     if (E.screencols - len == rlen) {
-      abAppend(ab, rstatus, rlen);
+      abAppend(line, rstatus, rlen);
       break;
     } else {
-      abAppend(ab, " ", 1);
+      abAppend(line, " ", 1);
       len++;
     }
   }
-  abAppend(ab, "\x1b[m", 3); //switches back to normal formatting
-  abAppend(ab, "\r\n", 2);
+  abAppend(line, "\x1b[m", 3); //switches back to normal formatting
+  editorDrawLine(ab, E.screenrows, line);
 }
 
 void editorDrawMessageBar(struct abuf *ab) {
@@ -762,11 +4221,13 @@ void editorDrawMessageBar(struct abuf *ab) {
   //"\x1b[K" erases the part of the line to the right of the cursor in case the
   // new line i shorter than the old
 
-  abAppend(ab, "\x1b[K", 3);
+  struct abuf *line = &drawline;
+  abAppend(line, "\x1b[K", 3);
   int msglen = strlen(E.statusmsg);
   if (msglen > E.screencols) msglen = E.screencols;
   //if (msglen && time(NULL) - E.statusmsg_time < 1000) //time
-    abAppend(ab, E.statusmsg, msglen);
+    abAppend(line, E.statusmsg, msglen);
+  editorDrawLine(ab, E.screenrows + 1, line);
 }
 
 void editorRefreshScreen(void) {
@@ -776,17 +4237,16 @@ void editorRefreshScreen(void) {
       char *b;
       int len;
     };*/
-  if (E.row)
-    editorSetMessage("length = %d, E.cx = %d, E.cy = %d, filerow = %d, filecol = %d, size = %d, E.filerows = %d, E.rowoff = %d, 0th = %d", editorGetLineCharCount(), E.cx, E.cy, editorGetFileRow(), editorGetFileCol(), E.row[editorGetFileRow()].size, E.filerows, E.rowoff, editorGetFileRowByLine(0)); 
-  else
-    editorSetMessage("E.row is NULL, E.cx = %d, E.cy = %d,  E.filerows = %d, E.rowoff = %d", E.cx, E.cy, E.filerows, E.rowoff); 
+  // the message bar only changes when something sets it, so most keys don't resend it
+  if (E.mode == 6) editorSearchMessage();
 
-  struct abuf ab = ABUF_INIT; //abuf *b = NULL and int len = 0
+  // the frame buffer is kept between refreshes and just emptied
+  static struct abuf ab = ABUF_INIT; //abuf *b = NULL and int len = 0
+  ab.len = 0;
 
   abAppend(&ab, "\x1b[?25l", 6); //hides the cursor
-  abAppend(&ab, "\x1b[H", 3);  //sends the cursor home
-
 
+  // only the lines that changed since the last refresh are added to ab - see editorDrawLine
   editorDrawRows(&ab);
   editorDrawStatusBar(&ab);
   editorDrawMessageBar(&ab);
@@ -798,12 +4258,17 @@ void editorRefreshScreen(void) {
   //                                          (E.cx - E.coloff) + 1);
   snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.cy + 1, E.cx + 1);
   abAppend(&ab, buf, strlen(buf));
+} else {
+  // the message bar may not have been redrawn so the cursor has to be put back at the end of it
+  char buf[32];
+  int msglen = strlen(E.statusmsg);
+  if (msglen > E.screencols) msglen = E.screencols;
+  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.screenrows + 2, msglen + 1);
+  abAppend(&ab, buf, strlen(buf));
 }
   abAppend(&ab, "\x1b[?25h", 6); //shows the cursor
 
   write(STDOUT_FILENO, ab.b, ab.len);
-
-  abFree(&ab);
 }
 
 /*va_list, va_start(), and va_end() come from <stdarg.h> and vsnprintf() is
@@ -826,7 +4291,7 @@ void editorSetMessage(const char *fmt, ...) {
 
 void editorMoveCursor(int key) {
 
-  if (!E.row) return; //could also be !E.filerows
+  if (E.filerows == 0) return;
 
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
@@ -844,7 +4309,7 @@ void editorMoveCursor(int key) {
     case ARROW_RIGHT:
     case 'l':
       ;
-      int row_size = E.row[fr].size;
+      int row_size = editorRow(fr)->size;
       int line_in_row = 1 + fc/E.screencols; //counting from one
       int total_lines = row_size/E.screencols;
       if (row_size%E.screencols) total_lines++;
@@ -896,6 +4361,19 @@ void editorProcessKeypress(void) {
 
   int c = editorReadKey();
 
+  if (c == PASTE_START) {
+    int len;
+    char *text = editorReadPaste(&len);
+    // a paste is one edit (one undo) in insert or normal mode and is ignored anywhere else
+    if (len && (E.mode == 0 || E.mode == 1)) {
+      editorCreateSnapshot();
+      editorInsertText(text, len);
+      if (E.mode == 0 && E.cx > 0) E.cx--;
+    }
+    free(text);
+    return;
+  }
+
 /*************************************** 
  * This is where you enter insert mode* 
  * E.mode = 1
@@ -912,6 +4390,7 @@ void editorProcessKeypress(void) {
       break;
 
     case CTRL_KEY('q'):
+      editorSaveWait();
       if (E.dirty && quit_times > 0) {
         editorSetMessage("WARNING!!! File has unsaved changes. "
           "Press Ctrl-Q %d more times to quit.", quit_times);
@@ -933,7 +4412,7 @@ void editorProcessKeypress(void) {
 
     case END_KEY:
       if (E.cy < E.filerows)
-        E.cx = E.row[E.cy].size;
+        E.cx = editorRow(E.cy)->size;
       break;
 
     case BACKSPACE:
@@ -988,7 +4467,7 @@ void editorProcessKeypress(void) {
       if (E.cx > 0) E.cx--;
       // below - if the indent amount == size of line then it's all blanks
       int n = editorIndentAmount(editorGetFileRow());
-      if (n == E.row[editorGetFileRow()].size) {
+      if (E.filerows && n == editorRow(editorGetFileRow())->size) {
         E.cx = 0;
         for (int i = 0; i < n; i++) {
           editorDelChar();
@@ -1163,12 +4642,19 @@ void editorProcessKeypress(void) {
       return;
 
     case 'G':
+      editorIndexAll();
       E.cx = 0;
       E.cy = editorGetScreenLineFromFileRow(E.filerows-1);
       E.command[0] = '\0';
       E.repeat = 0;
       return;
   
+    case '/':
+      editorSearchPrompt();
+      E.command[0] = '\0';
+      E.repeat = 0;
+      return;
+
     case ':':
       E.mode = 2;
       E.command[0] = ':';
@@ -1202,6 +4688,7 @@ void editorProcessKeypress(void) {
 
     case '*':  
       getWordUnderCursor();
+      search_regex = 0;
       editorFindNextWord(); 
       return;
 
@@ -1209,10 +4696,18 @@ void editorProcessKeypress(void) {
       editorFindNextWord();
       return;
 
+    case 'N':
+      editorFindPrevWord();
+      return;
+
     case 'u':
       editorRestoreSnapshot();
       return;
 
+    case CTRL_KEY('r'):
+      editorRedo();
+      return;
+
     case CTRL_KEY('z'):
       E.smartindent = (E.smartindent == 4) ? 0 : 4;
       editorSetMessage("E.smartindent = %d", E.smartindent); 
@@ -1287,7 +4782,7 @@ void editorProcessKeypress(void) {
       end = E.cx;
       E.cx = start; 
       for (int j = 0; j < end - start + 1; j++) editorDelChar();
-      E.cx = (start < E.row[E.cy].size) ? start : E.row[E.cy].size -1;
+      E.cx = (start < editorRow(E.cy)->size) ? start : editorRow(E.cy)->size -1;
       E.command[0] = '\0';
       E.repeat = 0;
       return;
@@ -1375,6 +4870,13 @@ void editorProcessKeypress(void) {
      E.repeat = 0;
      return;
 
+    case C_gminus:
+    case C_gplus:
+     editorUndoTime(E.repeat, 0, keyfromstring(E.command) == C_gplus);
+     E.command[0] = '\0';
+     E.repeat = 0;
+     return;
+
    case C_yy:  
      editorYankLine(E.repeat);
      E.command[0] = '\0';
@@ -1403,11 +4905,11 @@ void editorProcessKeypress(void) {
         if (strlen(E.command) > 3) {
           E.filename = strdup(&E.command[3]);
           editorSave();
-          editorSetMessage("\"%s\" written", E.filename);
+          if (!saver.running) editorSetMessage("\"%s\" written", E.filename);
         }
         else if (E.filename != NULL) {
-            editorSave();
-            editorSetMessage("\"%s\" written", E.filename);
+            editorSaveFile(E.command[2] == '!'); //:w! always does the full atomic save
+            if (!saver.running) editorSetMessage("\"%s\" written", E.filename);
         }
         else editorSetMessage("No file name");
 
@@ -1419,12 +4921,14 @@ void editorProcessKeypress(void) {
         if (strlen(E.command) > 3) {
           E.filename = strdup(&E.command[3]);
           editorSave();
+          editorSaveWait();
           write(STDOUT_FILENO, "\x1b[2J", 4); //clears the screen
           write(STDOUT_FILENO, "\x1b[H", 3); //cursor goes home, which is to first char
           exit(0);
         }
         else if (E.filename != NULL) {
           editorSave();
+          editorSaveWait();
           write(STDOUT_FILENO, "\x1b[2J", 4); //clears the screen
           write(STDOUT_FILENO, "\x1b[H", 3); //cursor goes home, which is to first char
           exit(0);
@@ -1435,7 +4939,32 @@ void editorProcessKeypress(void) {
         E.command[0] = '\0';
       }
 
+      // :earlier N/:later N go N changes back or forward - Ns, Nm, Nh or Nd by time
+      else if (strncmp(&E.command[1], "earlier", 7) == 0 || strncmp(&E.command[1], "later", 5) == 0) {
+        int later = E.command[1] == 'l';
+        char *unit;
+        long n = strtol(&E.command[later ? 6 : 8], &unit, 10);
+        if (n <= 0) n = 1;
+        int scale = 0;
+        switch (*unit) {
+          case 's': scale = 1; break;
+          case 'm': scale = 60; break;
+          case 'h': scale = 3600; break;
+          case 'd': scale = 86400; break;
+        }
+        E.mode = 0;
+        E.command[0] = '\0';
+        editorUndoTime(scale ? n * scale : n, scale != 0, later);
+      }
+
+      else if (E.command[1] == 's' || strncmp(&E.command[1], "%s", 2) == 0) {
+        E.mode = 0;
+        editorSubstitute(&E.command[1]);
+        E.command[0] = '\0';
+      }
+
       else if (E.command[1] == 'q') {
+        editorSaveWait();
         if (E.dirty) {
           if (strlen(E.command) == 3 && E.command[2] == '!') {
             write(STDOUT_FILENO, "\x1b[2J", 4); //clears the screen
@@ -1461,11 +4990,11 @@ void editorProcessKeypress(void) {
       int n = strlen(E.command);
       if (c == DEL_KEY || c == BACKSPACE) {
         E.command[n-1] = '\0';
-      } else {
+      } else if (n < (int)sizeof(E.command) - 1) {
         E.command[n] = c;
         E.command[n+1] = '\0';
       }
-      editorSetMessage(E.command);
+      editorSetMessage("%s", E.command);
     }
   /********************************************
    * visual line mode E.mode = 3
@@ -1626,101 +5155,81 @@ void editorProcessKeypress(void) {
       E.repeat = 0;
       E.command[0] = '\0';
       E.mode = 0;
+
+  } else if (E.mode == 6) {
+    editorSearchPromptKey(c);
   }
 }
 
 /*** slz additions ***/
-int editorGetFileRow(void) {
-  int screenrow = -1;
-  int n = 0;
-  int linerows;
+/* the cursor's file row and how far into it the cursor is only change when
+   the cursor moves to another screen line or the line layout changes
+   (E.linegen) so they are looked up once and cached - everything calls
+   editorGetFileRow/editorGetFileCol over and over for the same keystroke */
+struct {
+  int cy, rowoff, continuation, linegen; //what the cached values were worked out from
+  int fr; //editorGetFileRow()
+  int lines; //screen lines the cursor is below the first line of fr
+} poscache = {-1, 0, 0, -1, 0, 0};
+
+void editorCursorPos(void) {
+  rowStoreCheckCols();
+  if (poscache.cy == E.cy && poscache.rowoff == E.rowoff &&
+      poscache.continuation == E.continuation && poscache.linegen == E.linegen) return;
+
   int y = E.cy + E.rowoff; ////////
+  int n = 0;
   //if (E.cy == 0) return 0;
-  if (y == 0) return 0;
-  for (;;) {
-    linerows = E.row[n].size/E.screencols;
-    if (E.row[n].size%E.screencols) linerows++;
-    if (linerows == 0) linerows = 1;
-    screenrow+= linerows;
-    //if (screenrow >= E.cy) break;
-    if (screenrow >= y) break;
-    n++;
+  if (y != 0 && E.filerows != 0) {
+    n = editorScreenLineRow(y);
+    if (n == E.filerows) n--; //cursor is below the last row
+    // right now this is necesssary for backspacing in a multiline filerow
+    // no longer seems necessary for insertchar
+    if (E.continuation) n--;
   }
-  // right now this is necesssary for backspacing in a multiline filerow
-  // no longer seems necessary for insertchar
-  if (E.continuation) n--;
-  return n;
+  poscache.fr = n;
+  poscache.lines = (y == 0) ? 0 : y - editorRowScreenLine(n);
+  poscache.cy = E.cy;
+  poscache.rowoff = E.rowoff;
+  poscache.continuation = E.continuation;
+  poscache.linegen = E.linegen;
+}
+
+int editorGetFileRow(void) {
+  editorCursorPos();
+  return poscache.fr;
 }
 
 int editorGetFileRowByLine (int y){
-  int screenrow = -1;
-  int n = 0;
-  int linerows;
-  y+= E.rowoff;
-  if (y == 0) return 0;
-  for (;;) {
-    linerows = E.row[n].size/E.screencols;
-    if (E.row[n].size%E.screencols) linerows++;
-    if (linerows == 0) linerows = 1; // a row with no characters still takes up a line may also deal with last line
-    screenrow+= linerows;
-    if (screenrow >= y) break;
-    n++;
-  }
-  return n;
+  return editorScreenLineRow(y + E.rowoff); //E.filerows if line is below the last row
 }
 
 int *editorGetScreenPosFromFilePos(int fr, int fc){
   static int row_column[2]; //if not use static then it's a variable local to function
-  int screenline = 0;
-  int n = 0;
-  int rowlines;
+  int screenline = editorRowScreenLine(fr);
 
-  for (n=0;n < fr;n++) {
-    rowlines = E.row[n].size/E.screencols + 1;
-    if (E.row[n].size && E.row[n].size%E.screencols == 0) rowlines--;
-    screenline+= rowlines;
-  }
-
-  int incremental_lines = (E.row[fr].size >= fc) ? fc/E.screencols : E.row[fr].size/E.screencols;
+  int incremental_lines = (editorRow(fr)->size >= fc) ? fc/E.screencols : editorRow(fr)->size/E.screencols;
   screenline = screenline + incremental_lines - E.rowoff;
 
-  // since E.cx should be less than E.row[].size (since E.cx counts from zero and E.row[].size from 1
+  // since E.cx should be less than editorRow()->size (since E.cx counts from zero and editorRow()->size from 1
   // this can put E.cx one farther right than it should be but editorMoveCursor checks and moves it back if not in insert mode
-  int screencol = (E.row[fr].size > fc) ? fc%E.screencols : E.row[fr].size%E.screencols; 
+  int screencol = (editorRow(fr)->size > fc) ? fc%E.screencols : editorRow(fr)->size%E.screencols; 
   row_column[0] = screenline;
   row_column[1] = screencol;
 
   return row_column;
 }
 
-// returns E.cy for a given filerow - right now just used for 'G'
+// returns E.cy for a given filerow (its last line) - right now just used for 'G'
 int editorGetScreenLineFromFileRow (int fr){
-  int screenline = -1;
-  int n = 0;
-  int rowlines;
   if (fr == 0) return 0;
-  for (n=0;n < fr + 1;n++) {
-    rowlines = E.row[n].size/E.screencols;
-    if (E.row[n].size%E.screencols) rowlines++;
-    if (rowlines == 0) rowlines = 1; // a row with no characters still takes up a line may also deal with last line
-    screenline+= rowlines;
-  }
-  return screenline - E.rowoff;
-
+  return editorRowScreenLine(fr) + editorRowLines(editorRow(fr)->size) - 1 - E.rowoff;
 }
 
+// the number of screen lines the cursor is into its row times the width plus E.cx
 int editorGetFileCol(void) {
-  int n = 0;
-  int y = E.cy + E.rowoff;
-  int fr = editorGetFileRow();
-  for (;;) {
-    if (y == 0) break;
-    y--;
-    if (editorGetFileRowByLine(y) < fr) break;
-    n++;
-  }
-
-  int col = E.cx + n*E.screencols; 
+  editorCursorPos();
+  int col = E.cx + poscache.lines*E.screencols; 
   return col;
 }
 
@@ -1728,7 +5237,7 @@ int editorGetLineCharCount(void) {
 
   int fc = editorGetFileCol();
   int fr = editorGetFileRow();
-  int row_size = E.row[fr].size;
+  int row_size = editorRow(fr)->size;
   if (row_size <= E.screencols) return row_size;
   int line_in_row = 1 + fc/E.screencols; //counting from one
   int total_lines = row_size/E.screencols;
@@ -1736,40 +5245,159 @@ int editorGetLineCharCount(void) {
   if (line_in_row == total_lines) return row_size%E.screencols;
   else return E.screencols;
 }
+// the journal does the work now - this just marks the start of the next command's changes
 void editorCreateSnapshot(void) {
-  if ( E.filerows == 0 ) return; //don't create snapshot if there is no text
-  for (int j = 0 ; j < E.prev_filerows ; j++ ) {
-    free(E.prev_row[j].chars);
+  E.newgroup = 1;
+}
+
+/* applies a journal record forwards (redo) or backwards (undo) - 0 if it
+   doesn't fit the rows it names, which only a damaged undo file can make
+   happen: its records are checked on their own when it's read but the rows
+   aren't known until they're replayed */
+int editorReplay(undorec *u, int undo) {
+  int type = u->type;
+  if (undo) {
+    switch (type) {
+      case U_ROW_INS: type = U_ROW_DEL; break;
+      case U_ROW_DEL: type = U_ROW_INS; break;
+      case U_SPAN_INS: type = U_SPAN_DEL; break;
+      case U_SPAN_DEL: type = U_SPAN_INS; break;
+    }
+  }
+  editorIndexTo(u->fr);
+  if (type == U_ROW_INS ? u->fr > E.filerows : u->fr >= E.filerows) return 0;
+  if (type == U_SPAN_INS && u->at > editorRow(u->fr)->size) return 0;
+  if (type == U_SPAN_DEL && u->at > editorRow(u->fr)->size - u->len) return 0;
+  switch (type) {
+    case U_ROW_INS:
+      if (u->shared && E.piecetable) editorInsertPiece(u->fr, u->text, u->len);
+      else editorInsertRow(u->fr, u->text, u->len);
+      break;
+    case U_ROW_DEL:
+      editorRemoveRow(u->fr);
+      break;
+    case U_SPAN_INS:
+      editorRowInsertString(editorRow(u->fr), u->at, u->text, u->len);
+      break;
+    case U_SPAN_DEL:
+      editorRowDelChars(editorRow(u->fr), u->at, u->len);
+      break;
   }
-  E.prev_row = realloc(E.prev_row, sizeof(erow) * E.filerows );
-  for ( int i = 0 ; i < E.filerows ; i++ ) {
-    int len = E.row[i].size;
-    E.prev_row[i].chars = malloc(len + 1);
-    E.prev_row[i].size = len;
-    memcpy(E.prev_row[i].chars, E.row[i].chars, len);
-    E.prev_row[i].chars[len] = '\0';
+  return 1;
+}
+
+// drops history that turned out not to fit the file partway through replaying it - returns 0
+int editorUndoDamaged(void) {
+  E.replaying = 0;
+  editorUndoClear();
+  E.dirty++;
+  editorSetMessage("Undo file is damaged - old history dropped");
+  return 0;
+}
+
+// puts the cursor where an undone/redone change was
+void editorUndoCursor(undorec *u) {
+  E.continuation = 0;
+  if (E.filerows == 0) {
+    E.cx = E.cy = 0;
+    return;
   }
-  E.prev_filerows = E.filerows;
+  int fr = (u->fr < E.filerows) ? u->fr : E.filerows - 1;
+  int *pos = editorGetScreenPosFromFilePos(fr, u->at);
+  E.cy = pos[0];
+  E.cx = pos[1];
+}
+
+// undoes the current group and moves to its parent - 0 if old history turned out not to go with the file
+int editorUndoStep(void) {
+  int g = E.curgroup;
+  if (g < undofile.loaded && !editorUndoVerify()) return 0;
+  undogroup *ug = &E.undogroups[g];
+  E.replaying = 1;
+  for (int i = ug->start + ug->len - 1; i >= ug->start; i--)
+    if (!editorReplay(&E.undo[i], 1)) return editorUndoDamaged();
+  E.replaying = 0;
+  E.undogroups[ug->parent].lastchild = g; //so CTRL-R comes back here
+  E.curgroup = ug->parent;
+  editorUndoCursor(&E.undo[ug->start]);
+  E.dirty++;
+  return 1;
+}
+
+// redoes child, a child of the current group, and moves to it
+int editorRedoStep(int child) {
+  if (child < undofile.loaded && !editorUndoVerify()) return 0;
+  undogroup *ug = &E.undogroups[child];
+  E.replaying = 1;
+  for (int i = ug->start; i < ug->start + ug->len; i++)
+    if (!editorReplay(&E.undo[i], 0)) return editorUndoDamaged();
+  E.replaying = 0;
+  E.undogroups[E.curgroup].lastchild = child;
+  E.curgroup = child;
+  editorUndoCursor(&E.undo[ug->start]);
+  E.dirty++;
+  return 1;
 }
 
+// undoes the last group of changes - 'u'
 void editorRestoreSnapshot(void) {
-  for (int j = 0 ; j < E.filerows ; j++ ) {
-    free(E.row[j].chars);
-  } 
-  E.row = realloc(E.row, sizeof(erow) * E.prev_filerows );
-  for (int i = 0 ; i < E.prev_filerows ; i++ ) {
-    int len = E.prev_row[i].size;
-    E.row[i].chars = malloc(len + 1);
-    E.row[i].size = len;
-    memcpy(E.row[i].chars, E.prev_row[i].chars, len);
-    E.row[i].chars[len] = '\0';
+  if (E.curgroup == 0) {
+    editorSetMessage("Already at oldest change");
+    return;
+  }
+  editorUndoStep();
+}
+
+// redoes the last undone group - CTRL-R
+void editorRedo(void) {
+  int child = E.undogroups[E.curgroup].lastchild;
+  if (child == -1) {
+    editorSetMessage("Already at newest change");
+    return;
+  }
+  editorRedoStep(child);
+}
+
+// gets to group target - undoing up to where it branches off and redoing down to it
+void editorUndoGoto(int target) {
+  char *ontarget = calloc(E.numgroups, 1);
+  int *path = malloc(sizeof(int) * E.numgroups);
+  int n = 0;
+  for (int g = target; g != -1; g = E.undogroups[g].parent) {
+    ontarget[g] = 1;
+    path[n++] = g;
+  }
+  int ok = 1;
+  while (ok && !ontarget[E.curgroup]) ok = editorUndoStep();
+  if (ok) {
+    while (path[n - 1] != E.curgroup) n--;
+    for (n--; ok && n > 0; n--) ok = editorRedoStep(path[n - 1]);
+  }
+  free(ontarget);
+  free(path);
+}
+
+/* time travel - g- and g+ go count groups back or forward in the order they
+   were made, whichever branch they're on, and :earlier/:later go by seconds
+   when bytime is set.  either way it ends up at the newest group made by
+   then, the root if there isn't one */
+void editorUndoTime(int count, int bytime, int later) {
+  undogroup *cur = &E.undogroups[E.curgroup];
+  long long when = (bytime ? cur->time : cur->seq) + (later ? count : -count);
+  int target = 0;
+  for (int g = 1; g < E.numgroups; g++) //groups are in the order they were made
+    if ((bytime ? E.undogroups[g].time : E.undogroups[g].seq) <= when) target = g;
+  if (target == E.curgroup) {
+    editorSetMessage(later ? "Already at newest change" : "Already at oldest change");
+    return;
   }
-  E.filerows = E.prev_filerows;
+  editorUndoGoto(target);
+  editorSetMessage("Change %d of %d", E.undogroups[E.curgroup].seq, E.lastseq);
 }
 
 void editorChangeCase(void) {
-  erow *row = &E.row[E.cy];
-  char d = row->chars[E.cx];
+  erow *row = editorRow(E.cy);
+  char d = editorRowChars(row)[E.cx];
   if (d < 91 && d > 64) d = d + 32;
   else if (d > 96 && d < 123) d = d - 32;
   else {
@@ -1788,9 +5416,9 @@ void editorYankLine(int n){
 
   int fr = editorGetFileRow();
   for (int i=0; i < n; i++) {
-    int len = E.row[fr + i].size;
+    int len = editorRow(fr + i)->size;
     line_buffer[i] = malloc(len + 1);
-    memcpy(line_buffer[i], E.row[fr + i].chars, len);
+    editorRowRead(editorRow(fr + i), 0, len, line_buffer[i]);
     line_buffer[i][len] = '\0';
   }
   // set string_buffer to "" to signal should paste line and not chars
@@ -1800,9 +5428,9 @@ void editorYankLine(int n){
 void editorYankString(void) {
   int n,x;
   int fr = editorGetFileRow();
-  erow *row = &E.row[fr];
+  char *chars = editorRowChars(editorRow(fr));
   for (x = E.highlight[0], n = 0; x < E.highlight[1]+1; x++, n++) {
-      string_buffer[n] = row->chars[x];
+      string_buffer[n] = chars[x];
   }
 
   string_buffer[n] = '\0';
@@ -1815,24 +5443,11 @@ void editorPasteString(void) {
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
 
-  erow *row = &E.row[fr];
+  erow *row = editorRow(fr);
   //if (E.cx < 0 || E.cx > row->size) E.cx = row->size; 10-29-2018 ? is this necessary - not sure
   int len = strlen(string_buffer);
-  row->chars = realloc(row->chars, row->size + len); 
-
-  /* moving all the chars at the current x cursor position on char
-     farther down the char string to make room for the new character
-     Maybe a clue from editorInsertRow - it's memmove is below
-     memmove(&E.row[fr + 1], &E.row[fr], sizeof(erow) * (E.filerows - fr));
-  */
-
-  memmove(&row->chars[fc + len], &row->chars[fc], row->size - fc); //****was E.cx + 1
-
-  for (int i = 0; i < len; i++) {
-    row->size++;
-    row->chars[fc] = string_buffer[i];
-    fc++;
-  }
+  editorRowInsertString(row, fc, string_buffer, len);
+  fc += len;
   E.cx = fc%E.screencols; //this can't work in all circumstances - might have to move E.cy too
   E.dirty++;
 }
@@ -1852,7 +5467,7 @@ void editorPasteLine(void){
 
 void editorIndentRow(void) {
   int fr = editorGetFileRow();
-  erow *row = &E.row[fr];
+  erow *row = editorRow(fr);
   if (row->size == 0) return;
   //E.cx = 0;
   E.cx = editorIndentAmount(fr);
@@ -1861,11 +5476,11 @@ void editorIndentRow(void) {
 }
 
 void editorUnIndentRow(void) {
-  erow *row = &E.row[E.cy];
+  erow *row = editorRow(E.cy);
   if (row->size == 0) return;
   E.cx = 0;
   for (int i = 0; i < E.indent; i++) {
-    if (row->chars[0] == ' ') {
+    if (editorRowChars(row)[0] == ' ') {
       editorDelChar();
     }
   }
@@ -1874,25 +5489,28 @@ void editorUnIndentRow(void) {
 
 int editorIndentAmount(int fr) {
   int i;
-  erow *row = &E.row[fr];
-  if ( !row || row->size == 0 ) return 0; //row is NULL if the row has been deleted or opening app
+  if (fr >= E.filerows) return 0; //no row if the row has been deleted or opening app
+  erow *row = editorRow(fr);
+  if (row->size == 0) return 0;
+  char *chars = editorRowChars(row);
 
   for ( i = 0; i < row->size; i++) {
-    if (row->chars[i] != ' ') break;}
+    if (chars[i] != ' ') break;}
 
   return i;
 }
 
 void editorDelWord(void) {
-  erow *row = &E.row[E.cy];
-  if (row->chars[E.cx] < 48) return;
+  erow *row = editorRow(E.cy);
+  char *chars = editorRowChars(row);
+  if (chars[E.cx] < 48) return;
 
   int i,j,x;
   for (i = E.cx; i > -1; i--){
-    if (row->chars[i] < 48) break;
+    if (chars[i] < 48) break;
     }
   for (j = E.cx; j < row->size ; j++) {
-    if (row->chars[j] < 48) break;
+    if (chars[j] < 48) break;
   }
   E.cx = i+1;
 
@@ -1904,11 +5522,9 @@ void editorDelWord(void) {
 }
 
 void editorDeleteToEndOfLine(void) {
-  erow *row = &E.row[E.cy];
-  row->size = E.cx;
-  //Arguably you don't have to reallocate when you reduce the length of chars
-  row->chars = realloc(row->chars, E.cx + 1); //added 10042018 - before wasn't reallocating memory
-  row->chars[E.cx] = '\0';
+  erow *row = editorRow(E.cy);
+  //the chars past E.cx just become part of the gap
+  editorRowTruncate(row, E.cx);
   }
 
 void editorMoveCursorBOL(void) {
@@ -1930,7 +5546,7 @@ void editorMoveCursorEOL(void) {
  // possibly should turn line in row and total lines into a function but use does vary a little so maybe not 
   int fc = editorGetFileCol();
   int fr = editorGetFileRow();
-  int row_size = E.row[fr].size;
+  int row_size = editorRow(fr)->size;
   int line_in_row = 1 + fc/E.screencols; //counting from one
   int total_lines = row_size/E.screencols;
   if (row_size%E.screencols) total_lines++;
@@ -1946,10 +5562,11 @@ void editorMoveEndWord2() {
   int j;
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
-  erow row = E.row[fr];
+  erow *row = editorRow(fr);
+  char *chars = editorRowChars(row);
 
-  for (j = fc + 1; j < row.size ; j++) {
-    if (row.chars[j] < 48) break;
+  for (j = fc + 1; j < row->size ; j++) {
+    if (chars[j] < 48) break;
   }
 
   fc = j - 1;
@@ -1963,35 +5580,37 @@ void editorMoveNextWord(void) {
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
   int line_in_row = fc/E.screencols; //counting from zero
-  erow row = E.row[fr];
+  erow *row = editorRow(fr);
+  char *chars = editorRowChars(row);
 
-  if (row.chars[fc] < 48) j = fc;
+  if (chars[fc] < 48) j = fc;
   else {
-    for (j = fc + 1; j < row.size; j++) { 
-      if (row.chars[j] < 48) break;
+    for (j = fc + 1; j < row->size; j++) { 
+      if (chars[j] < 48) break;
     }
   } 
-  if (j >= row.size - 1) { // at end of line was ==
+  if (j >= row->size - 1) { // at end of line was ==
 
     if (fr == E.filerows - 1) return; // no more rows
     
     for (;;) {
       fr++;
       E.cy++;
-      row = E.row[fr];
-      if (row.size == 0 && fr == E.filerows - 1) return;
-      if (row.size) break;
+      row = editorRow(fr);
+      chars = editorRowChars(row);
+      if (row->size == 0 && fr == E.filerows - 1) return;
+      if (row->size) break;
       }
 
     line_in_row = 0;
     E.cx = 0;
     fc = 0;
-    if (row.chars[0] >= 48) return;  //Since we went to a new row it must be beginning of a word if char in 0th position
+    if (chars[0] >= 48) return;  //Since we went to a new row it must be beginning of a word if char in 0th position
   
   } else fc = j - 1;
   
-  for (j = fc + 1; j < row.size ; j++) { //+1
-    if (row.chars[j] > 48) break;
+  for (j = fc + 1; j < row->size ; j++) { //+1
+    if (chars[j] > 48) break;
   }
   fc = j;
   E.cx = fc%E.screencols;
@@ -2001,14 +5620,16 @@ void editorMoveNextWord(void) {
 void editorMoveBeginningWord(void) {
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
-  erow *row = &E.row[fr];
+  erow *row = editorRow(fr);
+  char *chars = editorRowChars(row);
   int line_in_row = fc/E.screencols; //counting from zero
   if (fc == 0){ 
     if (fr == 0) return;
       for (;;) {
         fr--;
         E.cy--;
-        row = &E.row[fr];
+        row = editorRow(fr);
+        chars = editorRowChars(row);
         if (row->size == 0 && fr==0) return;
         if (row->size) break;
       }
@@ -2018,14 +5639,14 @@ void editorMoveBeginningWord(void) {
 
   int j = fc;
   for (;;) {
-    if (row->chars[j - 1] < 48) j--;
+    if (chars[j - 1] < 48) j--;
     else break;
     if (j == 0) return; 
   }
 
   int i;
   for (i = j - 1; i > -1; i--){
-    if (row->chars[i] < 48) break;
+    if (chars[i] < 48) break;
   }
   fc = i + 1;
 
@@ -2038,7 +5659,8 @@ void editorMoveEndWord(void) {
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
   int line_in_row = fc/E.screencols; //counting from zero
-  erow *row = &E.row[fr];
+  erow *row = editorRow(fr);
+  char *chars = editorRowChars(row);
   int j;
 
   if (fc >= row->size - 1) {
@@ -2047,7 +5669,8 @@ void editorMoveEndWord(void) {
     for (;;) {
       fr++;
       E.cy++;
-      row = &E.row[fr];
+      row = editorRow(fr);
+      chars = editorRowChars(row);
       if (row->size == 0 && fr == E.filerows - 1) return;
       if (row->size) break;
       }
@@ -2056,15 +5679,15 @@ void editorMoveEndWord(void) {
     fc = 0;
   }
   j = fc + 1;
-  if (row->chars[j] < 48) {
+  if (chars[j] < 48) {
  
     for (j = fc + 1; j < row->size ; j++) {
-      if (row->chars[j] > 48) break;
+      if (chars[j] > 48) break;
     }
   }
   //for (j = E.cx + 1; j < row->size ; j++) {
   for (j++; j < row->size ; j++) {
-    if (row->chars[j] < 48) break;
+    if (chars[j] < 48) break;
   }
 
   fc = j - 1;
@@ -2075,23 +5698,24 @@ void editorMoveEndWord(void) {
 void editorDecorateWord(int c) {
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
-  erow *row = &E.row[fr];
+  erow *row = editorRow(fr);
+  char *chars = editorRowChars(row);
   char cc;
-  if (row->chars[fc] < 48) return;
+  if (chars[fc] < 48) return;
 
   int i, j;
 
   /*Note to catch ` would have to be row->chars[i] < 48 || row-chars[i] == 96 - may not be worth it*/
 
   for (i = fc - 1; i > -1; i--){
-    if (row->chars[i] < 48) break;
+    if (chars[i] < 48) break;
   }
 
   for (j = fc + 1; j < row->size ; j++) {
-    if (row->chars[j] < 48) break;
+    if (chars[j] < 48) break;
   }
   
-  if (row->chars[i] != '*' && row->chars[i] != '`'){
+  if (chars[i] != '*' && chars[i] != '`'){
     cc = (c == CTRL_KEY('b') || c ==CTRL_KEY('i')) ? '*' : '`';
     E.cx = i%E.screencols + 1;
     editorInsertChar(cc);
@@ -2141,21 +5765,22 @@ void editorDecorateVisual(int c) {
 void getWordUnderCursor(void){
   int fr = editorGetFileRow();
   int fc = editorGetFileCol();
-  erow *row = &E.row[fr];
-  if (row->chars[fc] < 48) return;
+  erow *row = editorRow(fr);
+  char *chars = editorRowChars(row);
+  if (chars[fc] < 48) return;
 
   int i,j,n,x;
 
   for (i = fc - 1; i > -1; i--){
-    if (row->chars[i] < 48) break;
+    if (chars[i] < 48) break;
   }
 
   for (j = fc + 1; j < row->size ; j++) {
-    if (row->chars[j] < 48) break;
+    if (chars[j] < 48) break;
   }
 
-  for (x = i + 1, n = 0; x < j; x++, n++) {
-      search_string[n] = row->chars[x];
+  for (x = i + 1, n = 0; x < j && n < (int)sizeof(search_string) - 1; x++, n++) {
+      search_string[n] = chars[x];
   }
 
   search_string[n] = '\0';
@@ -2163,34 +5788,145 @@ void getWordUnderCursor(void){
 
 }
 
-void editorFindNextWord(void) {
+// moves to the next match of search_string - or the one before the cursor when back is set ('N')
+void editorFindWord(int back) {
   int y, x;
-  char *z;
   int fc = editorGetFileCol();
   int fr = editorGetFileRow();
-  y = fr;
-  x = fc + 1;
-  erow *row;
- 
-  /*n counter so we can exit for loop if there are  no matches for command 'n'*/
-  for ( int n=0; n < E.filerows; n++ ) {
-    row = &E.row[y];
-    z = strstr(&(row->chars[x]), search_string);
-    if ( z != NULL ) {
-      break;
-    }
-    y++;
-    x = 0;
-    if ( y == E.filerows ) y = 0;
+  int len = strlen(search_string);
+  editorIndexAll();
+  if (len == 0 || E.filerows == 0) return;
+
+  if (!editorSearchNext(search_string, len, search_regex, fr, fc, back, &y, &x)) {
+    editorSetMessage("Pattern not found: %s", search_string);
+    return;
   }
-  fc = z - row->chars;
+  editorGotoMatch(y, x);
+  editorSetMessage("x = %d; y = %d", x, y);
+}
+
+// puts the cursor on column fc of file row y
+void editorGotoMatch(int y, int fc) {
+  erow *row = editorRow(y);
   E.cx = fc%E.screencols;
   int line_in_row = 1 + fc/E.screencols; //counting from one
   int total_lines = row->size/E.screencols;
   if (row->size%E.screencols) total_lines++;
   E.cy = editorGetScreenLineFromFileRow(y) - (total_lines - line_in_row); //that is screen line of last row in multi-row
+}
+
+void editorFindNextWord(void) {
+  editorFindWord(0);
+}
+
+void editorFindPrevWord(void) {
+  editorFindWord(1);
+}
+
+// copies the next /-terminated field of a :s command to buf - \/ is a /, other \s are left for the pattern
+char *editorSubstField(char *p, char *buf, int *len, int max) {
+  *len = 0;
+  while (*p && *p != '/') {
+    if (*p == '\\' && p[1] == '/') p++;
+    else if (*p == '\\' && p[1] && *len < max) buf[(*len)++] = *p++;
+    if (*len < max) buf[(*len)++] = *p;
+    p++;
+  }
+  buf[*len] = '\0';
+  return *p ? p + 1 : p;
+}
+
+// a row :s is changing - the part from the start of its first match to the end of its last, replaced, is built in out
+typedef struct subst {
+  const char *text;
+  const char *rep;
+  int rlen;
+  int nslots;
+  int first, upto;
+  struct abuf out;
+} subst;
+
+int editorSubstFound(void *arg, int *sub) {
+  subst *s = arg;
+  if (s->first == -1) s->first = sub[0];
+  if (sub[0] > s->upto) abAppend(&s->out, &s->text[s->upto], sub[0] - s->upto);
+  for (int i = 0; i < s->rlen; i++) {
+    int g = -1;
+    if (s->rep[i] == '&') g = 0;
+    else if (s->rep[i] == '\\' && i + 1 < s->rlen && s->rep[i + 1] >= '0' && s->rep[i + 1] <= '9') g = s->rep[++i] - '0';
+    else if (s->rep[i] == '\\' && i + 1 < s->rlen) i++;
+    if (g == -1) abAppend(&s->out, &s->rep[i], 1);
+    else if (2 * g < s->nslots && sub[2 * g] >= 0) abAppend(&s->out, &s->text[sub[2 * g]], sub[2 * g + 1] - sub[2 * g]);
+  }
+  s->upto = sub[1];
+  return 1;
+}
+
+/* :s/pattern/replacement/ changes the first match of pattern in the
+   cursor's row, :%s/.../ the first in every row, and a g after the last /
+   every match instead.  & in the replacement is what matched and \1 to \9
+   what the groups did.  Rows with a match are found the way 'n' finds them;
+   reMatches then works out where in each its matches end */
+void editorSubstitute(char *cmd) {
+  char pat[sizeof(E.command)], rep[sizeof(E.command)];
+  int plen, rlen;
+  int all = (*cmd == '%');
+  if (all) cmd++;
+  if (cmd[1] != '/') {
+    editorSetMessage("Usage: :[%%]s/pattern/replacement/[g]");
+    return;
+  }
+  cmd = editorSubstField(cmd + 2, pat, &plen, sizeof(pat) - 2);
+  cmd = editorSubstField(cmd, rep, &rlen, sizeof(rep) - 2);
+  int global = strchr(cmd, 'g') != NULL;
+  const char *err;
+  regex *re = reCompile(pat, plen, &err);
+  if (re == NULL) {
+    editorSetMessage("%s: %s", err, pat);
+    return;
+  }
+  editorIndexAll();
+  if (E.filerows == 0 || plen == 0) {
+    reFree(re);
+    return;
+  }
+
+  int fr = all ? 0 : editorGetFileRow();
+  int end = all ? E.filerows : fr + 1;
+  int subs = 0, lines = 0, last = -1;
+  subst st = {.rep = rep, .rlen = rlen, .nslots = 2 * (re->ngroups + 1), .out = ABUF_INIT};
+  redfa *dfa = reDfaNew(re);
+  editorCreateSnapshot();
+  int mfr, mfc;
+  while (fr < end && editorSearchRows(pat, plen, re, fr, 0, end, &mfr, &mfc)) {
+    erow *row = editorRow(mfr);
+    int size = row->size;
+    char *text = malloc(size ? size : 1);
+    editorRowRead(row, 0, size, text);
+    st.text = text;
+    st.first = -1;
+    st.upto = mfc;
+    st.out.len = 0;
+    subs += reMatches(dfa, text, size, mfc, global, editorSubstFound, &st);
+    if (st.first != -1) {
+      editorRowDelChars(row, st.first, st.upto - st.first);
+      if (st.out.len) editorRowInsertString(row, st.first, st.out.b, st.out.len);
+      E.dirty++;
+      lines++;
+      last = mfr;
+    }
+    free(text);
+    fr = mfr + 1;
+  }
+  abFree(&st.out);
+  reDfaFree(dfa);
+  reFree(re);
 
-    editorSetMessage("x = %d; y = %d", x, y); 
+  if (subs == 0) editorSetMessage("Pattern not found: %s", pat);
+  else {
+    editorGotoMatch(last, 0);
+    editorSetMessage("%d substitution%s on %d line%s", subs, subs == 1 ? "" : "s", lines, lines == 1 ? "" : "s");
+  }
 }
 
 void editorMarkupLink(void) {
@@ -2202,22 +5938,23 @@ void editorMarkupLink(void) {
   n = 1;
 
 
-  for ( n=1; E.row[numrows-n].chars[0] == '[' ; n++ );
+  for ( n=1; editorRowChars(editorRow(numrows-n))[0] == '[' ; n++ );
 
 
   for (y=0; y<numrows; y++){
-    erow *row = &E.row[y];
-    if (row->chars[0] == '[') continue;
-    if (strstr(row->chars, bracket_http)) continue;
+    erow *row = editorRow(y);
+    char *chars = editorRowChars(row);
+    if (chars[0] == '[') continue;
+    if (strstr(chars, bracket_http)) continue;
 
-    z = strstr(row->chars, http);
+    z = strstr(chars, http);
     if (z==NULL) continue;
     E.cy = y;
-    p = z - row->chars;
+    p = z - chars;
 
     //url including http:// must be at least 10 chars you'd think
     for (j = p + 10; j < row->size ; j++) { 
-      if (row->chars[j] == 32) break;
+      if (chars[j] == 32) break;
     }
 
     int len = j-p;
@@ -2233,7 +5970,7 @@ void editorMarkupLink(void) {
     editorInsertChar(48+n);
     editorInsertChar(']');
 
-    if ( E.row[numrows-1].chars[0] != '[' ) {
+    if ( editorRowChars(editorRow(numrows-1))[0] != '[' ) {
       E.cy = E.filerows - 1; //check why need - 1 otherwise seg faults
       E.cx = 0;
       editorInsertNewline(1);
@@ -2256,8 +5993,9 @@ void editorMarkupLink(void) {
 /*** slz testing stuff ***/
 
 void getcharundercursor(void) {
-  erow *row = &E.row[E.cy];
-  char d = row->chars[E.cx];
+  erow *row = editorRow(E.cy);
+  char *chars = editorRowChars(row);
+  char d = chars[E.cx];
   editorSetMessage("character under cursor at position %d of %d: %c", E.cx, row->size, d); 
 }
 
@@ -2271,15 +6009,36 @@ void initEditor(void) {
   E.rowoff = 0;  //row the user is currently scrolled to  
   E.coloff = 0;  //col the user is currently scrolled to  
   E.filerows = 0; //number of rows (lines) of text delineated by a return
-  E.row = NULL; //pointer to the erow structure 'array'
-  E.prev_filerows = 0; //number of rows of text in snapshot
-  E.prev_row = NULL; //prev_row is pointer to snapshot for undoing
+  E.chunks = NULL; //the row store - see editorRow()
+  E.numchunks = 0;
+  E.chunkcap = 0;
+  E.chunkrows = NULL;
+  E.chunklines = NULL;
+  E.linegen = 0;
+  E.piecetable = 1;
+  E.orig = NULL;
+  E.origlen = 0;
+  E.origmapped = 0;
+  E.indexed = 0;
+  E.addbuf = NULL;
+  E.undo = NULL; //undo journal
+  E.undolen = E.undocap = 0;
+  E.undogroups = NULL;
+  E.numgroups = E.groupcap = 0;
+  E.curgroup = 0;
+  E.newgroup = 0;
+  E.lastseq = 0;
+  E.undomem = 0;
+  E.undomax = UNDO_MEM_DEFAULT;
+  E.replaying = 0;
   E.dirty = 0; //has filed changed since last save
+  E.changedrow = INT_MAX;
+  memset(&E.disk, 0, sizeof(E.disk));
   E.filename = NULL;
   E.statusmsg[0] = '\0'; //very bottom of screen; ex. -- INSERT --
   //E.statusmsg_time = 0;
   E.highlight[0] = E.highlight[1] = -1;
-  E.mode = 0; //0=normal; 1=insert; 2=command line; 3=visual line; 4=visual; 5='r' 
+  E.mode = 0; //0=normal; 1=insert; 2=command line; 3=visual line; 4=visual; 5='r'; 6=search ('/') 
   E.command[0] = '\0';
   E.repeat = 0; //number of times to repeat commands like x,s,yy also used for visual line mode x,y
   E.indent = 4;
@@ -2289,38 +6048,61 @@ void initEditor(void) {
   if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
   E.screenrows -= 2;
   E.screencols -=2;
+  E.linecols = E.screencols;
 }
 
 int main(int argc, char *argv[]) {
+  int opt;
+  int recover = 0;
   enableRawMode();
   initEditor();
-  if (argc >= 2) {
-    editorOpen(argv[1]);
+
+  // -c reads the file the old way with every row copied into its own buffer
+  // -r recovers the changes in the file's swap file after a crash
+  // -u N caps undo history at about N MB
+  while ((opt = getopt(argc, argv, "cru:")) != -1) {
+    if (opt == 'c') E.piecetable = 0;
+    if (opt == 'r') recover = 1;
+    if (opt == 'u') E.undomax = (size_t)atol(optarg) * 1024 * 1024;
+  }
+
+  if (optind < argc) {
+    editorOpen(argv[optind]);
   }
 
   // for testing purposes added the else - inserts text for testing purposes 
   // when no file is being read
   else {
     editorInsertRow(0, "Hello, Steve!", 13); 
-    E.cx = E.row[0].size; //put cursor at end of line
+    E.cx = editorRow(0)->size; //put cursor at end of line
     editorInsertNewline(1); 
     editorInsertRow(E.filerows, "http://www.webmd.com", 20); //testing url markup
     editorInsertRow(E.filerows, "The quick brown fox jumps over the lazy dog", 43); 
-    E.cx = E.row[0].size - 1; //put cursor at end of line
+    E.cx = editorRow(0)->size - 1; //put cursor at end of line
     E.cy = 0;
   }
 
+  editorUndoClear(); //reading in the file isn't something to undo
+  E.changedrow = INT_MAX; //or a change to it
+
   //editorSetMessage("HELP: Ctrl-S = save | Ctrl-Q = quit"); //slz commented this out
   editorSetMessage("rows: %d  cols: %d", E.screenrows, E.screencols); //for display screen dimens
+  editorUndoLoad();
+  editorSwapOpen(recover);
 
   while (1) {
     editorRefreshScreen(); 
     editorProcessKeypress();
+    // keys that were typed ahead or pasted all get handled before the next redraw
+    while (editorKeysPending()) {
+      editorScroll();
+      editorProcessKeypress();
+    }
 /*
-    if (E.row)
-      editorSetMessage("length = %d, E.cx = %d, E.cy = %d, filerow = %d, filecol = %d, size = %d, E.filerows = %d, E.rowoff = %d, 0th = %d", editorGetLineCharCount(), E.cx, E.cy, editorGetFileRow(), editorGetFileCol(), E.row[editorGetFileRow()].size, E.filerows, E.rowoff, editorGetFileRowByLine(0)); 
+    if (E.filerows)
+      editorSetMessage("length = %d, E.cx = %d, E.cy = %d, filerow = %d, filecol = %d, size = %d, E.filerows = %d, E.rowoff = %d, 0th = %d", editorGetLineCharCount(), E.cx, E.cy, editorGetFileRow(), editorGetFileCol(), editorRow(editorGetFileRow())->size, E.filerows, E.rowoff, editorGetFileRowByLine(0)); 
     else
-      editorSetMessage("E.row is NULL, E.cx = %d, E.cy = %d,  E.filerows = %d, E.rowoff = %d", E.cx, E.cy, E.filerows, E.rowoff); 
+      editorSetMessage("No rows, E.cx = %d, E.cy = %d,  E.filerows = %d, E.rowoff = %d", E.cx, E.cy, E.filerows, E.rowoff); 
 */
     
   }
@@ -0,0 +1,114 @@
+/* times the regex search on patterns that take a backtracking matcher
+   exponential time, and :s on rows whose matches a naive matcher would
+   find in quadratic time.  Builds the editor in with its main renamed so
+   it's the same code '/' and :s run - make bench.  Exits 1 if :s doesn't
+   stay linear in the length of the row. */
+
+#define main kilo_main
+#include "kilo_lw_scroll.c"
+#undef main
+
+#define BENCH_MB (1024*1024)
+
+double benchNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// makes the row text the file being edited - through a temporary file so it's read the way a real one is
+void benchOpen(const char *text, int len) {
+  char path[] = "/tmp/regex_benchXXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1 || write(fd, text, len) != len || write(fd, "\n", 1) != 1) die("regex_bench");
+  unlink(path);
+  memset(&E, 0, sizeof(E));
+  E.screenrows = 22;
+  E.screencols = E.linecols = 78;
+  E.piecetable = 1;
+  E.undomax = UNDO_MEM_DEFAULT;
+  E.changedrow = INT_MAX;
+  E.highlight[0] = E.highlight[1] = -1;
+  editorOpenPieces(fd);
+  close(fd);
+  editorIndexAll();
+}
+
+// n copies of c
+char *benchRow(int c, int n) {
+  char *text = malloc(n);
+  memset(text, c, n);
+  return text;
+}
+
+// n random a's and b's
+char *benchRowAB(int n) {
+  char *text = malloc(n);
+  srand(1);
+  for (int i = 0; i < n; i++) text[i] = "ab"[rand() % 2];
+  return text;
+}
+
+// the time '/' takes to find the first match of pat in text
+void benchSearch(const char *pat, char *text, int n) {
+  benchOpen(text, n);
+  const char *err;
+  regex *re = reCompile(pat, strlen(pat), &err);
+  int mfr, mfc;
+  double t = benchNow();
+  int found = editorSearchRows(pat, strlen(pat), re, 0, 0, E.filerows, &mfr, &mfc);
+  t = benchNow() - t;
+  printf("/%-24.24s %5d KB  %8.1f ms  %s\n", pat, n / 1024, t * 1000, found ? "match" : "no match");
+  reFree(re);
+}
+
+// the time :%s takes with cmd on text - and what it did
+double benchSubst(const char *cmd, char *text, int n) {
+  benchOpen(text, n);
+  char buf[sizeof(E.command)];
+  snprintf(buf, sizeof(buf), "%s", cmd);
+  double t = benchNow();
+  editorSubstitute(buf);
+  t = benchNow() - t;
+  printf(":%-24.24s %5d KB  %8.1f ms  %s\n", cmd, n / 1024, t * 1000, E.statusmsg);
+  return t;
+}
+
+int main(void) {
+  char *a = benchRow('a', BENCH_MB);
+  benchSearch("(a*)*b", a, BENCH_MB);
+  benchSearch("(a|aa)*c", a, BENCH_MB);
+  benchSearch("(x+x+)+y", a, BENCH_MB);
+  char *x = benchRow('x', BENCH_MB);
+  benchSearch("(x+x+)+y", x, BENCH_MB);
+  benchSearch("(a|b)*c", a, BENCH_MB);
+
+  // read right to left the DFA has to remember the last 18 characters, so the cache is thrown away over and over
+  char flush[256] = "";
+  for (int i = 0; i < 17; i++) strcat(flush, "(a|b)");
+  strcat(flush, "a");
+  char *ab = benchRowAB(BENCH_MB);
+  benchSearch(flush, ab, BENCH_MB);
+
+  benchSubst("%s/(a*)*b/X/g", a, BENCH_MB);
+  benchSubst("%s/(a|aa)*/X/g", a, BENCH_MB);
+  benchSubst("%s/a/b/g", a, BENCH_MB);
+  char sflush[sizeof(flush) + 16];
+  snprintf(sflush, sizeof(sflush), "%%s/%s/X/g", flush);
+  benchSubst(sflush, ab, BENCH_MB);
+
+  /* each match is one x, but a matcher that settles each one by running on
+     to the end of the row takes n^2 - so twice the row mustn't take four
+     times as long.  Stops at the first size that does rather than waiting
+     for a quadratic :s to get through a big row */
+  double last = 0;
+  for (int n = 4096; n <= BENCH_MB; n *= 2) {
+    double t = benchSubst("%s/x.*y|x/z/g", x, n);
+    if (last > 0.01 && t > 3 * last) {
+      printf(":s took %.1f times as long on a row twice as long - it isn't linear\n", t / last);
+      return 1;
+    }
+    last = t;
+  }
+  return 0;
+}
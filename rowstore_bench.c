@@ -0,0 +1,121 @@
+/* times inserting and deleting rows at random places in the chunked row
+   store (rowStoreInsert/rowStoreDelete) against the one flat array of erows
+   kilo.c keeps, where every insert reallocs it and moves every row after
+   it.  Builds the editor in with its main renamed so it's the same store
+   editing uses - make bench.  Exits 1 if the two don't end up with the
+   same rows in the same order. */
+
+#define main kilo_main
+#include "kilo_lw_scroll.c"
+#undef main
+
+#define BENCH_OPS 2000 //inserts, then as many deletes
+
+double benchNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int benchCmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void benchReport(const char *how, const char *op, int rows, double *lat) {
+  double total = 0;
+  for (int i = 0; i < BENCH_OPS; i++) total += lat[i];
+  qsort(lat, BENCH_OPS, sizeof(double), benchCmp);
+  printf("%-6s %-6s %8d rows  %8.0f ns/op  p99 %8.0f ns  max %9.0f ns\n", how, op, rows,
+         total / BENCH_OPS * 1e9, lat[BENCH_OPS / 100 * 99] * 1e9, lat[BENCH_OPS - 1] * 1e9);
+}
+
+// each row is told apart by where its piece points in tags
+char *tags;
+
+erow *flat;
+int flatrows;
+
+void flatInsert(int at, int tag) {
+  flat = realloc(flat, sizeof(erow) * (flatrows + 1));
+  memmove(&flat[at + 1], &flat[at], sizeof(erow) * (flatrows - at));
+  flat[at] = (erow){0, NULL, 0, 0, &tags[tag], NULL};
+  flatrows++;
+}
+
+void flatDelete(int at) {
+  memmove(&flat[at], &flat[at + 1], sizeof(erow) * (flatrows - at - 1));
+  flatrows--;
+}
+
+void storeInsert(int at, int tag) {
+  erow *row = rowStoreInsert(at);
+  row->chars = NULL;
+  row->gap = row->gaplen = 0;
+  row->piece = &tags[tag];
+}
+
+/* starts both with rows rows, then does the same random inserts and
+   deletes to each - 0 if they don't match afterwards */
+int benchRows(int rows, double *lat) {
+  int *pos = malloc(sizeof(int) * BENCH_OPS);
+
+  rowStoreClear();
+  free(flat);
+  flat = NULL;
+  flatrows = 0;
+  for (int i = 0; i < rows; i++) {
+    storeInsert(i, i);
+    flatInsert(i, i);
+  }
+
+  srand(rows);
+  for (int i = 0; i < BENCH_OPS; i++) pos[i] = rand() % (rows + i + 1);
+  for (int i = 0; i < BENCH_OPS; i++) {
+    double t = benchNow();
+    flatInsert(pos[i], rows + i);
+    lat[i] = benchNow() - t;
+  }
+  benchReport("flat", "insert", rows, lat);
+  for (int i = 0; i < BENCH_OPS; i++) {
+    double t = benchNow();
+    storeInsert(pos[i], rows + i);
+    lat[i] = benchNow() - t;
+  }
+  benchReport("chunks", "insert", rows, lat);
+
+  for (int i = 0; i < BENCH_OPS; i++) pos[i] = rand() % (rows + BENCH_OPS - i);
+  for (int i = 0; i < BENCH_OPS; i++) {
+    double t = benchNow();
+    flatDelete(pos[i]);
+    lat[i] = benchNow() - t;
+  }
+  benchReport("flat", "delete", rows, lat);
+  for (int i = 0; i < BENCH_OPS; i++) {
+    double t = benchNow();
+    rowStoreDelete(pos[i]);
+    lat[i] = benchNow() - t;
+  }
+  benchReport("chunks", "delete", rows, lat);
+  free(pos);
+
+  if (E.filerows != flatrows) return 0;
+  for (int fr = 0; fr < flatrows; fr++)
+    if (editorRow(fr)->piece != flat[fr].piece) return 0;
+  return 1;
+}
+
+int main(void) {
+  memset(&E, 0, sizeof(E));
+  E.screenrows = 22;
+  E.screencols = E.linecols = 78;
+  tags = malloc(1000000 + BENCH_OPS);
+  double *lat = malloc(sizeof(double) * BENCH_OPS);
+  for (int rows = 10000; rows <= 1000000; rows *= 10) {
+    if (!benchRows(rows, lat)) {
+      printf("the row store doesn't have the rows the flat array has after %d inserts and deletes\n", 2 * BENCH_OPS);
+      return 1;
+    }
+  }
+  return 0;
+}
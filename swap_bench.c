@@ -0,0 +1,96 @@
+/* times inserting characters the way typing does with the swap journal off
+   and on, one keystroke at a time, to show logging a change stays off the
+   disk's path.  Builds the editor in with its main renamed so it's the same
+   code a keystroke runs - make bench.  Exits 1 if the swap file doesn't end
+   up with every keystroke in it. */
+
+#define main kilo_main
+#include "kilo_lw_scroll.c"
+#undef main
+
+#define BENCH_KEYS 200000
+#define BENCH_ROWS 1000
+#define BENCH_COLS 60 //characters typed on a row before going on to the next
+
+double benchNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// makes text the file being edited - the file stays for the swap file to go next to
+void benchOpen(char *path, const char *text, int len) {
+  int fd = mkstemp(path);
+  if (fd == -1 || write(fd, text, len) != len) die("swap_bench");
+  memset(&E, 0, sizeof(E));
+  E.screenrows = 22;
+  E.screencols = E.linecols = 78;
+  E.piecetable = 1;
+  E.undomax = UNDO_MEM_DEFAULT;
+  E.changedrow = INT_MAX;
+  E.highlight[0] = E.highlight[1] = -1;
+  E.filename = strdup(path);
+  fstat(fd, &E.disk);
+  editorOpenPieces(fd);
+  close(fd);
+  editorIndexAll();
+}
+
+int benchCmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* types BENCH_KEYS characters, a group of changes to each row as insert
+   mode makes them, and prints how long the keystrokes took */
+void benchType(const char *how, double *lat) {
+  double total = benchNow();
+  for (int i = 0; i < BENCH_KEYS; i++) {
+    int fr = i / BENCH_COLS % BENCH_ROWS;
+    double t = benchNow();
+    if (i % BENCH_COLS == 0) editorCreateSnapshot();
+    erow *row = editorRow(fr);
+    editorRowInsertChar(row, row->size, 'a' + i % 26);
+    lat[i] = benchNow() - t;
+  }
+  total = benchNow() - total;
+  qsort(lat, BENCH_KEYS, sizeof(double), benchCmp);
+  printf("swap %-4s %d keys  %8.1f ms  %6.0f ns/key  p99 %6.0f ns  max %8.0f ns\n", how, BENCH_KEYS,
+         total * 1000, total / BENCH_KEYS * 1e9, lat[BENCH_KEYS / 100 * 99] * 1e9, lat[BENCH_KEYS - 1] * 1e9);
+}
+
+int main(void) {
+  char text[BENCH_ROWS * 81];
+  for (int i = 0; i < BENCH_ROWS; i++) {
+    memset(&text[i * 81], 'x', 80);
+    text[i * 81 + 80] = '\n';
+  }
+  double *lat = malloc(sizeof(double) * BENCH_KEYS);
+
+  char path[] = "/tmp/swap_benchXXXXXX";
+  benchOpen(path, text, sizeof(text));
+  benchType("off", lat);
+  unlink(path);
+
+  char path2[] = "/tmp/swap_benchXXXXXX";
+  benchOpen(path2, text, sizeof(text));
+  editorSwapOpen(0);
+  if (swap.fd == -1) die("swap_bench");
+  benchType("on", lat);
+
+  // what's left is written out when the editor exits - keep it to check it's all there
+  swap.keep = 1;
+  double t = benchNow();
+  editorSwapClose();
+  printf("swap drain %8.1f ms\n", (benchNow() - t) * 1000);
+  struct stat st;
+  int got = stat(swap.path, &st) == 0 ? (int)st.st_size : -1;
+  unlink(swap.path);
+  unlink(path2);
+  int want = sizeof(swapheader) + BENCH_KEYS * (sizeof(swaprec) + 1);
+  if (got != want) {
+    printf("swap file is %d bytes - %d keystrokes need %d\n", got, BENCH_KEYS, want);
+    return 1;
+  }
+  return 0;
+}